@@ -4,21 +4,22 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "miniwave.h"
-
-#define WAV_ERR(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
-#define WAV_WRN(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
-#define WAV_INF(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
-#define WAV_DBG(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
+#include "miniwave_private.h"
 
 /************************************************************************************************************************/
 
@@ -36,75 +37,6 @@ void miniwave_version(char *name, int *major, int *minor, char *date)
 
 /************************************************************************************************************************/
 
-struct RIFF_CHUNK
-{
-	char            riffType[4];    //4byte,资源交换文件标志:RIFF
-    unsigned int    riffSize;       //4byte,从下个地址到文件结尾的总字节数
-    char            waveType[4];    //4byte,wave文件标志:WAVE
-};
-
-struct FMTS_CHUNK
-{
-	char            formatType[4];  //4byte,波形文件标志:FMT
-    unsigned int    formatSize;     //4byte,音频属性(compressionCode,numChannels,sampleRate,bytesPerSecond,blockAlign,bitsPerSample)所占字节数
-    unsigned short  compressionCode;//2byte,编码格式(1-线性pcm-WAVE_FORMAT_PCM,WAVEFORMAT_ADPCM)
-    unsigned short  numChannels;    //2byte,通道数
-    unsigned int    sampleRate;     //4byte,采样率
-    unsigned int    bytesPerSecond; //4byte,传输速率
-    unsigned short  blockAlign;     //2byte,数据块的对齐
-    unsigned short  bitsPerSample;  //2byte,采样精度
-};
-
-struct FACT_CHUNK
-{
-	char			factType[4];	// 4byte,
-	unsigned int	factSize;
-};
-
-struct DATA_CHUNK
-{
-	char            dataType[4];    //4byte,数据标志:data
-    unsigned int    dataSize;       //4byte,从下个地址到文件结尾的总字节数，即除了wav header以外的pcm data length
-};
-
-struct WAVE_HEADER
-{
-	struct RIFF_CHUNK	riff;
-	struct FMTS_CHUNK	fmts;
-	union {
-		struct FACT_CHUNK fact;
-		struct DATA_CHUNK data;
-	};
-};
-
-#define RIFF_TYPE		"RIFF"
-#define RIFF_TYPE_SIZE	strlen(RIFF_TYPE)
-#define WAVE_TYPE		"WAVE"
-#define WAVE_TYPE_SIZE	strlen(WAVE_TYPE)
-#define FMTS_TYPE		"fmt "
-#define FMTS_TYPE_SIZE	strlen(FMTS_TYPE)
-#define FACT_TYPE		"fact"
-#define FACT_TYPE_SIZE	strlen(FACT_TYPE)
-#define DATA_TYPE		"data"
-#define DATA_TYPE_SIZE	strlen(DATA_TYPE)
-
-#define RIFF_CHUNK_SIZE	sizeof(struct RIFF_CHUNK)
-#define FMTS_CHUNK_SIZE	sizeof(struct FMTS_CHUNK)
-#define FACT_CHUNK_SIZE	sizeof(struct FACT_CHUNK)
-#define DATA_CHUNK_SIZE	sizeof(struct DATA_CHUNK)
-
-struct WAVE
-{
-	int file;
-	unsigned int flags;
-	struct WAVE_HEADER header;
-	unsigned int dataOffset;
-};
-
-#define WAVE_O_INTERNAL  (1 << 31)
-
-/************************************************************************************************************************/
-
 static int wave2file_flags(int flags)
 {
     if (flags & WAVE_O_WRONLY)
@@ -141,15 +73,20 @@ static int wave_chunk_read(int file, off_t offset, void *chunk, unsigned int siz
 	return retval;
 }
 
-static int wave_header_read(int file, struct WAVE_HEADER *header)
+int wave_header_read(int file, struct WAVE_HEADER *header, struct WAVE_EXTRA *extra)
 {
 	struct RIFF_CHUNK *riff = &(header->riff);
 	struct FMTS_CHUNK *fmts = &(header->fmts);
-	struct FACT_CHUNK *fact = &(header->fact);
 	struct DATA_CHUNK *data = &(header->data);
+	struct WAVE_EXTRA ignore;
 	off_t offset = 0;
 	int retval = 0;
 
+	if (extra == NULL)
+		extra = &ignore;
+
+	memset(extra, 0, sizeof(struct WAVE_EXTRA));
+
 	retval = wave_chunk_read(file, offset, riff, RIFF_CHUNK_SIZE);
 	if (retval < 0)
 		return retval;
@@ -196,27 +133,39 @@ static int wave_header_read(int file, struct WAVE_HEADER *header)
 		return -EPERM;
 	}
 
-	offset += (fmts->formatSize + 8);
+	/* 压缩格式的扩展字段: cbSize + samplesPerBlock */
+	if (fmts->formatSize >= (FMTS_CHUNK_SIZE - 8) + 4)
+	{
+		retval = wave_chunk_read(file, offset + FMTS_CHUNK_SIZE, &(extra->cbSize), 4);
+		if (retval < 0)
+			return retval;
+	}
 
-	retval = wave_chunk_read(file, offset, fact, FACT_CHUNK_SIZE);
-	if (retval < 0)
-		return retval;
+	offset += (fmts->formatSize + 8);
 
-	if (memcmp(fact->factType, FACT_TYPE, FACT_TYPE_SIZE) == 0)
+	/* data之前可能还有fact/LIST等块, 逐块查找 */
+	while (1)
 	{
-		offset += FACT_CHUNK_SIZE + fact->factSize;
-
 		retval = wave_chunk_read(file, offset, data, DATA_CHUNK_SIZE);
 		if (retval < 0)
+		{
+			WAV_ERR("No data chunk found");
 			return retval;
-	}
+		}
 
-	if (memcmp(data->dataType, DATA_TYPE, DATA_TYPE_SIZE))
-	{
-		WAV_ERR("Invalid dataType[%c%c%c%c]",
-				data->dataType[0], data->dataType[1],
-				data->dataType[2], data->dataType[3]);
-		return -EPERM;
+		if (memcmp(data->dataType, DATA_TYPE, DATA_TYPE_SIZE) == 0)
+			break;
+
+		if ((memcmp(data->dataType, FACT_TYPE, FACT_TYPE_SIZE) == 0) && (data->dataSize >= 4))
+		{
+			retval = wave_chunk_read(file, offset + FACT_CHUNK_SIZE, &(extra->sampleLength), 4);
+			if (retval < 0)
+				return retval;
+
+			extra->hasFact = 1;
+		}
+
+		offset += DATA_CHUNK_SIZE + data->dataSize + (data->dataSize & 1);
 	}
 
 	offset += DATA_CHUNK_SIZE;
@@ -224,8 +173,30 @@ static int wave_header_read(int file, struct WAVE_HEADER *header)
 	return (int)offset;
 }
 
-static int wave_header_write(int file, struct WAVE_HEADER *header)
+/* 从data块末尾开始逐块查找附加块, 返回块内容的偏移 */
+off_t wave_trailer_find(int file, off_t offset, const char *type, unsigned int *size)
+{
+	struct DATA_CHUNK chunk;
+
+	offset += (offset & 1);
+
+	while (pread(file, &chunk, DATA_CHUNK_SIZE, offset) == DATA_CHUNK_SIZE)
+	{
+		if (memcmp(chunk.dataType, type, 4) == 0)
+		{
+			*size = chunk.dataSize;
+			return offset + DATA_CHUNK_SIZE;
+		}
+
+		offset += DATA_CHUNK_SIZE + chunk.dataSize + (chunk.dataSize & 1);
+	}
+
+	return -ENOENT;
+}
+
+int wave_header_write(int file, const void *header, unsigned int size)
 {
+	off_t offset = 0;
 	int retval = 0;
 
 	retval = lseek(file, 0, SEEK_SET);
@@ -236,239 +207,164 @@ static int wave_header_write(int file, struct WAVE_HEADER *header)
 		goto ERR_EXIT;
 	}
 
-	retval = write(file, header, sizeof(struct WAVE_HEADER));
+	retval = write(file, header, size);
 	if (retval < 0)
 	{
-		WAV_ERR("write(%d, %p, %lu) fail[%d]", \
-			file, header, sizeof(struct WAVE_HEADER), errno);
+		WAV_ERR("write(%d, %p, %u) fail[%d]", \
+			file, header, size, errno);
 		retval = -errno;
 	}
-	else if (retval != sizeof(struct WAVE_HEADER))
+	else if (retval != size)
 	{
-		WAV_WRN("write(%d, %p, %lu) real[%d]", \
-			file, header, sizeof(struct WAVE_HEADER), retval);
+		WAV_WRN("write(%d, %p, %u) real[%d]", \
+			file, header, size, retval);
 		retval = -EIO;
 	}
 
 ERR_EXIT:
-	retval = lseek(file, 0, SEEK_END);
-	if (retval < 0)
+	/* 回到文件末尾继续追加, 前面的错误优先返回 */
+	offset = lseek(file, 0, SEEK_END);
+	if (offset < 0)
 	{
 		WAV_ERR("lseek(%d, 0, SEEK_END) fail[%d]", file, errno);
-		retval = -errno;
-		goto ERR_EXIT;
+		if (retval >= 0)
+			retval = -errno;
 	}
+	else if (retval >= 0)
+		retval = offset;
 
 	return retval;
 }
 
-static void miniwave_dump(struct WAVE *wave)
-{
-	struct RIFF_CHUNK *riff = &(wave->header.riff);
-	struct FMTS_CHUNK *fmts = &(wave->header.fmts);
-	struct DATA_CHUNK *data = &(wave->header.data);
-
-	WAV_INF("####################################");
-	WAV_INF("wave file[%d]", wave->file);
-	WAV_INF("wave flags[0x%08x]", wave->flags);
-
-	WAV_INF("riffType[%c%c%c%c]",
-			riff->riffType[0], riff->riffType[1],
-			riff->riffType[2], riff->riffType[3]);
-	WAV_INF("riffSize[%u]", riff->riffSize);
-	WAV_INF("waveType[%c%c%c%c]",
-			riff->waveType[0], riff->waveType[1],
-			riff->waveType[2], riff->waveType[3]);
-
-	WAV_INF("formatType[%c%c%c%c]",
-			fmts->formatType[0], fmts->formatType[1],
-			fmts->formatType[2], fmts->formatType[3]);
-	WAV_INF("formatSize[%u]", fmts->formatSize);
-	WAV_INF("compressionCode[%u]", fmts->compressionCode);
-	WAV_INF("numChannels[%u]", fmts->numChannels);
-	WAV_INF("sampleRate[%u]", fmts->sampleRate);
-	WAV_INF("bytesPerSecond[%u]", fmts->bytesPerSecond);
-	WAV_INF("blockAlign[%u]", fmts->blockAlign);
-	WAV_INF("bitsPerSample[%u]", fmts->bitsPerSample);
-
-	WAV_INF("dataType[%c%c%c%c]",
-			data->dataType[0], data->dataType[1],
-			data->dataType[2], data->dataType[3]);
-	WAV_INF("dataSize[%u]", data->dataSize);
-
-	WAV_INF("wave dataOffset[%u]", wave->dataOffset);
-}
-
-static void miniwave_attr_dump(WAV_ATTR *attr)
-{
-	WAV_INF("====================================");
-	WAV_INF("samprate = %u", attr->samprate);
-	WAV_INF("sampbits = %u", attr->sampbits);
-	WAV_INF("channels = %u", attr->channels);
-	WAV_INF("dataoffs = %u", attr->dataoffs);
-	WAV_INF("datasize = %u", attr->datasize);
-}
-
-/************************************************************************************************************************/
-
-WAV miniwave_open(const char *name, int flags, WAV_ATTR *attr)
-{
-    int file = 0;
-
-    file = open(name, wave2file_flags(flags), 0755);
-    if (file == 0)
-    {
-        WAV_ERR("open(%s, 0x%02x) fail[%d]",
-                name, wave2file_flags(flags), file);
-        return (WAV)NULL;
-    }
-
-    flags |= WAVE_O_INTERNAL;
-
-    return miniwave_open_with_file(file, flags, attr);
-}
-
-WAV miniwave_open_with_file(int file, int flags, WAV_ATTR *attr)
+static int wave_header_writev(int file, void *header, unsigned int size,
+				const struct iovec *iov, int iovcnt)
 {
-    struct WAVE *wave = NULL;
-    struct WAVE_HEADER *header = NULL;
+	struct iovec vec[WAVE_IOV_HEAD + 1];
 	int retval = 0;
 
-	if ((file < 0) || (attr == NULL))
+	/* 数组太大时退化为头部单独写 */
+	if (iovcnt > WAVE_IOV_HEAD)
 	{
-		WAV_ERR("Invalid file[%d] attr[%p]", file, attr);
-		return (WAV)NULL;
-	}
+		retval = wave_header_write(file, header, size);
+		if (retval < 0)
+			return retval;
 
-    wave = (struct WAVE *)malloc(sizeof(struct WAVE));
-    if (wave == NULL)
-    {
-        WAV_ERR("malloc(%lu) fail", sizeof(struct WAVE));
-        goto ERR_EXIT;
-    }
+		retval = writev(file, iov, iovcnt);
+		if (retval < 0)
+		{
+			WAV_ERR("writev(%d, %p, %d) fail[%d]", file, iov, iovcnt, errno);
+			return -errno;
+		}
 
-    wave->file  = file;
-    wave->flags = flags;
+		return retval;
+	}
 
-	retval = lseek(file, 0, SEEK_SET);
+	vec[0].iov_base = header;
+	vec[0].iov_len  = size;
+	memcpy(&vec[1], iov, iovcnt * sizeof(struct iovec));
+
+	retval = pwritev(file, vec, iovcnt + 1, 0);
 	if (retval < 0)
 	{
-		WAV_ERR("lseek(%d, 0, SEEK_SET) fail[%d]", file, errno);
-		goto ERR_EXIT;
+		WAV_ERR("pwritev(%d, %p, %d, 0) fail[%d]", file, vec, iovcnt + 1, errno);
+		return -errno;
+	}
+	else if (retval < size)
+	{
+		WAV_WRN("pwritev(%d, %p, %d, 0) real[%d]", file, vec, iovcnt + 1, retval);
+		return -EIO;
 	}
 
-    header = &(wave->header);
+	if (lseek(file, retval, SEEK_SET) < 0)
+	{
+		WAV_ERR("lseek(%d, %d, SEEK_SET) fail[%d]", file, retval, errno);
+		return -errno;
+	}
 
-    if (flags & WAVE_O_WRONLY)
-    {
-        memcpy(header->riff.riffType, RIFF_TYPE, RIFF_TYPE_SIZE);
-        header->riff.riffSize = sizeof(struct WAVE) - 8;
-        memcpy(header->riff.waveType, WAVE_TYPE, WAVE_TYPE_SIZE);
-        memcpy(header->fmts.formatType, FMTS_TYPE, FMTS_TYPE_SIZE);
-        header->fmts.formatSize = 16;
-        header->fmts.compressionCode = 1;
-        header->fmts.numChannels = attr->channels;
-        header->fmts.sampleRate = attr->samprate;
-        header->fmts.bytesPerSecond = attr->samprate * \
-			attr->channels * attr->sampbits / 8;
-        header->fmts.blockAlign = attr->samprate * attr->channels / 8;
-        header->fmts.bitsPerSample = attr->sampbits;
-        memcpy(header->data.dataType, DATA_TYPE, DATA_TYPE_SIZE);
-        header->data.dataSize = 0;
+	return retval - size;
+}
 
-		retval = wave_header_write(file, header);
-		if (retval < 0)
-			goto ERR_EXIT;
+/* 压缩格式的头部映像: 扩展fmt(cbSize + samplesPerBlock) + fact */
+unsigned int wave_header_pack_ext(struct WAVE *wave, struct WAVE_HEADER_EXT *ext,
+				unsigned int samplesPerBlock, unsigned int sampleLength)
+{
+	struct WAVE_HEADER *header = &(wave->header);
+
+	memcpy(&(ext->riff), &(header->riff), RIFF_CHUNK_SIZE);
+	memcpy(&(ext->fmts), &(header->fmts), FMTS_CHUNK_SIZE);
+	ext->cbSize = 2;
+	ext->samplesPerBlock = samplesPerBlock;
+	memcpy(ext->fact.factType, FACT_TYPE, FACT_TYPE_SIZE);
+	ext->fact.factSize = 4;
+	ext->sampleLength = sampleLength;
+	memcpy(&(ext->data), &(header->data), DATA_CHUNK_SIZE);
+	ext->riff.riffSize = sizeof(struct WAVE_HEADER_EXT) - 8 + header->data.dataSize + wave->trailer;
+
+	return sizeof(struct WAVE_HEADER_EXT);
+}
 
-		wave->dataOffset = sizeof(struct WAVE_HEADER);
-    }
-    else
-    {
-		retval = wave_header_read(file, header);
-		if (retval < 0)
-			goto ERR_EXIT;
+/* 句柄当前头部的磁盘映像: PCM为44字节, 压缩格式由编解码器生成 */
+static unsigned int wave_header_pack(struct WAVE *wave, void **image)
+{
+	struct WAVE_HEADER *header = &(wave->header);
 
-		wave->dataOffset = retval;
-    }
+	if (wave->codec)
+		return wave->codec->pack(wave, image);
 
-	miniwave_dump(wave);
-	miniwave_attr((WAV)wave, attr);
+	header->riff.riffSize = sizeof(struct WAVE_HEADER) - 8 + header->data.dataSize + wave->trailer;
+	*image = header;
 
-	return (WAV)wave;
+	return sizeof(struct WAVE_HEADER);
+}
 
-ERR_EXIT:
-	if (flags & WAVE_O_INTERNAL)
-		close(file);
+static int wave_header_flush(struct WAVE *wave)
+{
+	unsigned int size = 0;
+	void *image = NULL;
 
-	if (wave)
-		free(wave);
+	size = wave_header_pack(wave, &image);
 
-	return (WAV)NULL;
+	return wave_header_write(wave->file, image, size);
 }
 
-int miniwave_attr(WAV wav, WAV_ATTR *attr)
+static int wave_iov_length(const struct iovec *iov, int iovcnt)
 {
-	struct WAVE *wave = (struct WAVE *)wav;
-	struct FMTS_CHUNK *fmts = NULL;
-	struct DATA_CHUNK *data = NULL;
-	unsigned int offset = 0;
+	size_t length = 0;
+	int i = 0;
 
-	if ((wav == NULL) || (attr == NULL))
-	{
-		WAV_ERR("Invalid wav[%p] attr[%p]", wav, attr);
+	if ((iov == NULL) || (iovcnt <= 0) || (iovcnt > IOV_MAX))
 		return -EINVAL;
-	}
 
-	offset = lseek(wave->file, 0, SEEK_CUR);
-	if (offset < 0)
+	for (i = 0; i < iovcnt; i++)
 	{
-		WAV_ERR("lseek(%d, 0, SEEK_CUR) fail[%d]", wave->file, errno);
-		return -errno;
-	}
-
-	fmts = &(wave->header.fmts);
-	data = &(wave->header.data);
-
-	attr->samprate = fmts->sampleRate;
-	attr->channels = fmts->numChannels;
-	attr->sampbits = fmts->bytesPerSecond / \
-			fmts->sampleRate / fmts->numChannels * 8;
-	attr->dataoffs = (offset > wave->dataOffset) ? \
-			(offset - wave->dataOffset) : 0;
-	attr->datasize = data->dataSize;
+		if ((iov[i].iov_base == NULL) && iov[i].iov_len)
+			return -EINVAL;
 
-	miniwave_attr_dump(attr);
+		length += iov[i].iov_len;
+		if (length > INT_MAX)
+			return -EINVAL;
+	}
 
-	return 0;
+	return (int)length;
 }
 
-int miniwave_read(WAV wav, void *buf, int len)
+static int wave_frame_check(struct WAVE *wave, int len)
 {
-	struct WAVE *wave = (struct WAVE *)wav;
-	struct FMTS_CHUNK *fmts = NULL;
-	struct DATA_CHUNK *data = NULL;
+	struct FMTS_CHUNK *fmts = &(wave->header.fmts);
+	WAV_ATTR attr;
 	int databytes = 0;
-	int offset = 0;
-	int retval = 0;
-
-	if ((wav == NULL) || (buf == NULL) || (len <= 0))
-	{
-		WAV_ERR("Invalid wav[%p] buf[%p] len[%d]", wav, buf, len);
-		return -EINVAL;
-	}
 
-	if (!(wave->flags & WAVE_O_RDONLY))
+	/* 压缩格式按调用者收发的PCM位宽检查 */
+	if (wave->codec)
 	{
-		WAV_ERR("Can't read wave file");
-		return -EPERM;
+		memset(&attr, 0, sizeof(WAV_ATTR));
+		wave->codec->attr(wave, &attr);
+		databytes = attr.sampbits / 8;
 	}
-
-	fmts = &(wave->header.fmts);
-	data = &(wave->header.data);
-
-	databytes = fmts->bytesPerSecond / \
-				fmts->sampleRate / \
-				fmts->numChannels;
+	else
+		databytes = fmts->bytesPerSecond / \
+					fmts->sampleRate / \
+					fmts->numChannels;
 
 	if (databytes <= 0 || databytes > 4)
 	{
@@ -483,40 +379,1223 @@ int miniwave_read(WAV wav, void *buf, int len)
 		return -EINVAL;
 	}
 
-	offset = lseek(wave->file, 0, SEEK_CUR);
-	if (offset < 0)
+	return databytes * fmts->numChannels;
+}
+
+/*
+ * O_DIRECT写入缓冲池: 多个录音句柄同时打开关闭时复用对齐缓冲区,
+ * 避免每个文件都重新申请/释放大块对齐内存.
+ */
+static struct
+{
+	pthread_mutex_t lock;
+	void *buffers[WAVE_DIO_POOL];
+	int count;
+} wave_dio_pool = {PTHREAD_MUTEX_INITIALIZER};
+
+static void *wave_dio_alloc(void)
+{
+	void *buffer = NULL;
+	int retval = 0;
+
+	pthread_mutex_lock(&wave_dio_pool.lock);
+	if (wave_dio_pool.count > 0)
+		buffer = wave_dio_pool.buffers[--wave_dio_pool.count];
+	pthread_mutex_unlock(&wave_dio_pool.lock);
+
+	if (buffer)
+		return buffer;
+
+	retval = posix_memalign(&buffer, WAVE_DIO_ALIGN, WAVE_DIO_BUFSIZE);
+	if (retval)
 	{
-		WAV_ERR("lseek(%d, 0, SEEK_CUR) fail[%d]", wave->file, errno);
-		return -errno;
+		WAV_ERR("posix_memalign(%d, %d) fail[%d]",
+			WAVE_DIO_ALIGN, WAVE_DIO_BUFSIZE, retval);
+		return NULL;
 	}
 
-	if (offset >= (wave->dataOffset + data->dataSize))
+	return buffer;
+}
+
+static void wave_dio_free(void *buffer)
+{
+	if (buffer == NULL)
+		return;
+
+	pthread_mutex_lock(&wave_dio_pool.lock);
+	if (wave_dio_pool.count < WAVE_DIO_POOL)
 	{
-		WAV_INF("end of read wave file");
-		return 0;
+		wave_dio_pool.buffers[wave_dio_pool.count++] = buffer;
+		buffer = NULL;
 	}
+	pthread_mutex_unlock(&wave_dio_pool.lock);
 
-	if (len > (data->dataSize + wave->dataOffset - offset))
-		len = (data->dataSize + wave->dataOffset - offset);
+	if (buffer)
+		free(buffer);
+}
 
-	retval = read(wave->file, buf, len);
+static int wave_dio_pwrite(int file, void *buf, unsigned int size, off_t offset)
+{
+	int retval = 0;
+
+	retval = pwrite(file, buf, size, offset);
 	if (retval < 0)
 	{
-		WAV_ERR("read(%d, %p, %d) fail[%d]", wave->file, buf, len, errno);
+		WAV_ERR("pwrite(%d, %p, %u, %ld) fail[%d]",
+			file, buf, size, (long)offset, errno);
 		return -errno;
 	}
+	else if (retval != size)
+	{
+		WAV_WRN("pwrite(%d, %p, %u, %ld) real[%d]",
+			file, buf, size, (long)offset, retval);
+		return -EIO;
+	}
 
 	return retval;
 }
 
-int miniwave_write(WAV wav, void *buf, int len)
+static int wave_dio_open(struct WAVE *wave)
 {
-	struct WAVE *wave = (struct WAVE *)wav;
-	struct RIFF_CHUNK *riff = NULL;
+	struct WAVE_DIO *dio = &(wave->dio);
+	void *image = NULL;
+	int retval = 0;
+
+	dio->buffer = wave_dio_alloc();
+	if (dio->buffer == NULL)
+		return -ENOMEM;
+
+	retval = posix_memalign((void **)&(dio->block), WAVE_DIO_ALIGN, WAVE_DIO_ALIGN);
+	if (retval)
+	{
+		WAV_ERR("posix_memalign(%d, %d) fail[%d]",
+			WAVE_DIO_ALIGN, WAVE_DIO_ALIGN, retval);
+		wave_dio_free(dio->buffer);
+		dio->buffer = NULL;
+		dio->block = NULL;
+		return -retval;
+	}
+
+	/* 头部占用首个缓冲区开头, 和第一段数据一起落盘 */
+	dio->length = wave_header_pack(wave, &image);
+	memcpy(dio->buffer, image, dio->length);
+	dio->offset = 0;
+
+	return 0;
+}
+
+static int wave_dio_write(struct WAVE *wave, const void *buf, int len)
+{
+	struct WAVE_DIO *dio = &(wave->dio);
+	const unsigned char *data = buf;
+	unsigned int size = 0;
+	int retval = 0;
+
+	while (len > 0)
+	{
+		size = WAVE_DIO_BUFSIZE - dio->length;
+		if (size > len)
+			size = len;
+
+		memcpy(dio->buffer + dio->length, data, size);
+		dio->length += size;
+		data += size;
+		len -= size;
+
+		if (dio->length < WAVE_DIO_BUFSIZE)
+			break;
+
+		retval = wave_dio_pwrite(wave->file, dio->buffer, WAVE_DIO_BUFSIZE, dio->offset);
+		if (retval < 0)
+		{
+			/* 前面已落盘或留在缓冲区的字节算作写入, 只退回本段 */
+			dio->length -= size;
+			data -= size;
+			if (data > (const unsigned char *)buf)
+				break;
+			return retval;
+		}
+
+		if (dio->offset == 0)
+			memcpy(dio->block, dio->buffer, WAVE_DIO_ALIGN);
+
+		dio->offset += WAVE_DIO_BUFSIZE;
+		dio->length = 0;
+	}
+
+	return (int)(data - (const unsigned char *)buf);
+}
+
+static int wave_dio_close(struct WAVE *wave)
+{
+	struct WAVE_DIO *dio = &(wave->dio);
+	unsigned int length = 0;
+	unsigned int size = 0;
+	void *image = NULL;
+	int retval = 0;
+
+	size = wave_header_pack(wave, &image);
+
+	if (dio->offset == 0)
+		memcpy(dio->buffer, image, size);
+
+	/* 末尾不足一个对齐块的部分补零写入, 再截断到实际长度 */
+	length = (dio->length + WAVE_DIO_ALIGN - 1) & ~(WAVE_DIO_ALIGN - 1);
+	memset(dio->buffer + dio->length, 0, length - dio->length);
+
+	retval = wave_dio_pwrite(wave->file, dio->buffer, length, dio->offset);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	if (dio->offset > 0)
+	{
+		memcpy(dio->block, image, size);
+
+		retval = wave_dio_pwrite(wave->file, dio->block, WAVE_DIO_ALIGN, 0);
+		if (retval < 0)
+			goto ERR_EXIT;
+	}
+
+	retval = ftruncate(wave->file, dio->offset + dio->length);
+	if (retval < 0)
+	{
+		WAV_ERR("ftruncate(%d, %ld) fail[%d]",
+			wave->file, (long)(dio->offset + dio->length), errno);
+		retval = -errno;
+	}
+
+ERR_EXIT:
+	wave_dio_free(dio->buffer);
+	free(dio->block);
+	dio->buffer = NULL;
+	dio->block = NULL;
+
+	return retval;
+}
+
+static int wave_file_direct(struct WAVE *wave)
+{
+	int flags = 0;
+
+	flags = fcntl(wave->file, F_GETFL);
+	if (flags < 0)
+	{
+		WAV_ERR("fcntl(%d, F_GETFL) fail[%d]", wave->file, errno);
+		return -errno;
+	}
+
+	if (fcntl(wave->file, F_SETFL, flags | O_DIRECT) < 0)
+	{
+		WAV_WRN("fcntl(%d, F_SETFL, O_DIRECT) fail[%d]", wave->file, errno);
+		return -errno;
+	}
+
+	wave->dio.fflags = flags;
+
+	return 0;
+}
+
+/* 调用者传入的文件描述符关闭后还会继续使用, 恢复原来的状态标志 */
+static int wave_file_restore(struct WAVE *wave)
+{
+	if (fcntl(wave->file, F_SETFL, wave->dio.fflags) < 0)
+	{
+		WAV_ERR("fcntl(%d, F_SETFL, %#x) fail[%d]", wave->file, wave->dio.fflags, errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static void wave_file_prealloc(int file, unsigned int size)
+{
+	/* KEEP_SIZE只预留区段不改变文件长度, 读者不会看到未写入的数据 */
+	if (fallocate(file, FALLOC_FL_KEEP_SIZE, 0, size) < 0)
+		WAV_WRN("fallocate(%d, KEEP_SIZE, 0, %u) fail[%d]", file, size, errno);
+}
+
+/*
+ * 预读线程: 顺序把数据块读入环形缓冲区, miniwave_read()直接从内存拷贝,
+ * 读者消费当前缓冲区时后台线程已在填充下一个.
+ */
+static void *wave_ra_thread(void *arg)
+{
+	struct WAVE_RA *ra = (struct WAVE_RA *)arg;
+	unsigned int size = 0;
+	off_t offset = 0;
+	int retval = 0;
+
+	pthread_mutex_lock(&ra->lock);
+
+	while (!ra->stop && !ra->error && (ra->offset < ra->end))
+	{
+		if (ra->count >= ra->depth)
+		{
+			pthread_cond_wait(&ra->cond, &ra->lock);
+			continue;
+		}
+
+		offset = ra->offset;
+		size = ra->size;
+		if (size > ra->end - offset)
+			size = ra->end - offset;
+
+		/* tail缓冲区只有本线程访问, 读盘时不持锁 */
+		pthread_mutex_unlock(&ra->lock);
+		retval = pread(ra->file, ra->buffers[ra->tail], size, offset);
+		pthread_mutex_lock(&ra->lock);
+
+		if (retval < 0)
+		{
+			WAV_ERR("pread(%d, %u, %ld) fail[%d]", ra->file, size, (long)offset, errno);
+			ra->error = -errno;
+		}
+		else if (retval == 0)
+		{
+			WAV_WRN("pread(%d, %u, %ld) truncated", ra->file, size, (long)offset);
+			ra->end = offset;
+		}
+		else
+		{
+			ra->lengths[ra->tail] = retval;
+			ra->tail = (ra->tail + 1) % ra->depth;
+			ra->count++;
+			ra->offset += retval;
+		}
+
+		pthread_cond_broadcast(&ra->cond);
+	}
+
+	/* 唤醒等待数据的读者 */
+	ra->stop = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+
+	return NULL;
+}
+
+static int wave_ra_read(struct WAVE_RA *ra, void *buf, int len)
+{
+	unsigned char *data = buf;
+	unsigned int size = 0;
+	int retval = 0;
+
+	pthread_mutex_lock(&ra->lock);
+
+	while (len > 0)
+	{
+		if (ra->count == 0)
+		{
+			if (ra->stop)
+				break;
+
+			pthread_cond_wait(&ra->cond, &ra->lock);
+			continue;
+		}
+
+		size = ra->lengths[ra->head] - ra->used;
+		if (size > len)
+			size = len;
+
+		/* head缓冲区在count计数内, 后台线程不会改写 */
+		pthread_mutex_unlock(&ra->lock);
+		memcpy(data, ra->buffers[ra->head] + ra->used, size);
+		pthread_mutex_lock(&ra->lock);
+
+		data += size;
+		len -= size;
+		ra->used += size;
+		ra->position += size;
+
+		if (ra->used == ra->lengths[ra->head])
+		{
+			ra->head = (ra->head + 1) % ra->depth;
+			ra->count--;
+			ra->used = 0;
+			pthread_cond_broadcast(&ra->cond);
+		}
+	}
+
+	retval = (int)(data - (unsigned char *)buf);
+	if ((retval == 0) && ra->error)
+		retval = ra->error;
+
+	pthread_mutex_unlock(&ra->lock);
+
+	return retval;
+}
+
+static void wave_ra_free(struct WAVE_RA *ra)
+{
+	unsigned int i = 0;
+
+	if (ra->buffers)
+	{
+		for (i = 0; i < ra->depth; i++)
+			free(ra->buffers[i]);
+		free(ra->buffers);
+	}
+
+	free(ra->lengths);
+	pthread_cond_destroy(&ra->cond);
+	pthread_mutex_destroy(&ra->lock);
+	free(ra);
+}
+
+static void wave_ra_close(struct WAVE_RA *ra)
+{
+	pthread_mutex_lock(&ra->lock);
+	ra->stop = 1;
+	pthread_cond_broadcast(&ra->cond);
+	pthread_mutex_unlock(&ra->lock);
+
+	pthread_join(ra->thread, NULL);
+
+	wave_ra_free(ra);
+}
+
+static void miniwave_dump(struct WAVE *wave)
+{
+	struct RIFF_CHUNK *riff = &(wave->header.riff);
+	struct FMTS_CHUNK *fmts = &(wave->header.fmts);
+	struct DATA_CHUNK *data = &(wave->header.data);
+
+	WAV_INF("####################################");
+	WAV_INF("wave file[%d]", wave->file);
+	WAV_INF("wave flags[0x%08x]", wave->flags);
+
+	WAV_INF("riffType[%c%c%c%c]",
+			riff->riffType[0], riff->riffType[1],
+			riff->riffType[2], riff->riffType[3]);
+	WAV_INF("riffSize[%u]", riff->riffSize);
+	WAV_INF("waveType[%c%c%c%c]",
+			riff->waveType[0], riff->waveType[1],
+			riff->waveType[2], riff->waveType[3]);
+
+	WAV_INF("formatType[%c%c%c%c]",
+			fmts->formatType[0], fmts->formatType[1],
+			fmts->formatType[2], fmts->formatType[3]);
+	WAV_INF("formatSize[%u]", fmts->formatSize);
+	WAV_INF("compressionCode[%u]", fmts->compressionCode);
+	WAV_INF("numChannels[%u]", fmts->numChannels);
+	WAV_INF("sampleRate[%u]", fmts->sampleRate);
+	WAV_INF("bytesPerSecond[%u]", fmts->bytesPerSecond);
+	WAV_INF("blockAlign[%u]", fmts->blockAlign);
+	WAV_INF("bitsPerSample[%u]", fmts->bitsPerSample);
+
+	WAV_INF("dataType[%c%c%c%c]",
+			data->dataType[0], data->dataType[1],
+			data->dataType[2], data->dataType[3]);
+	WAV_INF("dataSize[%u]", data->dataSize);
+
+	WAV_INF("wave dataOffset[%u]", wave->dataOffset);
+}
+
+static void miniwave_attr_dump(WAV_ATTR *attr)
+{
+	WAV_INF("====================================");
+	WAV_INF("samprate = %u", attr->samprate);
+	WAV_INF("sampbits = %u", attr->sampbits);
+	WAV_INF("channels = %u", attr->channels);
+	WAV_INF("dataoffs = %u", attr->dataoffs);
+	WAV_INF("datasize = %u", attr->datasize);
+	WAV_INF("prealloc = %u", attr->prealloc);
+}
+
+/************************************************************************************************************************/
+
+WAV miniwave_open(const char *name, int flags, WAV_ATTR *attr)
+{
+    int file = 0;
+
+    file = open(name, wave2file_flags(flags), 0755);
+    if (file < 0)
+    {
+        WAV_ERR("open(%s, 0x%02x) fail[%d]",
+                name, wave2file_flags(flags), file);
+        return (WAV)NULL;
+    }
+
+    flags |= WAVE_O_INTERNAL;
+
+    return miniwave_open_with_file(file, flags, attr);
+}
+
+WAV miniwave_open_with_file(int file, int flags, WAV_ATTR *attr)
+{
+    struct WAVE *wave = NULL;
+    struct WAVE_HEADER *header = NULL;
+	struct WAVE_EXTRA extra;
+	void *image = NULL;
+	int retval = 0;
+
+	if ((file < 0) || (attr == NULL))
+	{
+		WAV_ERR("Invalid file[%d] attr[%p]", file, attr);
+		return (WAV)NULL;
+	}
+
+    wave = (struct WAVE *)malloc(sizeof(struct WAVE));
+    if (wave == NULL)
+    {
+        WAV_ERR("malloc(%lu) fail", sizeof(struct WAVE));
+        goto ERR_EXIT;
+    }
+
+    memset(wave, 0, sizeof(struct WAVE));
+    wave->file  = file;
+    wave->flags = flags;
+
+	if (!(flags & WAVE_O_WRONLY))
+		wave->flags &= ~(WAVE_O_PREALLOC | WAVE_O_DIRECT | WAVE_O_ADPCM | WAVE_O_LOSSLESS);
+
+	if ((wave->flags & WAVE_O_ADPCM) && (wave->flags & WAVE_O_LOSSLESS))
+	{
+		WAV_ERR("WAVE_O_ADPCM and WAVE_O_LOSSLESS are exclusive");
+		goto ERR_EXIT;
+	}
+
+	/* 有损编码解出的PCM和写入的不同, 保存的哈希无法校验 */
+	if ((wave->flags & WAVE_O_ADPCM) && (wave->flags & WAVE_O_HASH))
+	{
+		WAV_ERR("WAVE_O_HASH can't be stored with lossy WAVE_O_ADPCM");
+		goto ERR_EXIT;
+	}
+
+	if ((wave->flags & WAVE_O_DIRECT) && wave_file_direct(wave) < 0)
+	{
+		WAV_WRN("O_DIRECT unsupported, fallback to buffered write");
+		wave->flags &= ~WAVE_O_DIRECT;
+	}
+
+	retval = lseek(file, 0, SEEK_SET);
+	if (retval < 0)
+	{
+		WAV_ERR("lseek(%d, 0, SEEK_SET) fail[%d]", file, errno);
+		goto ERR_EXIT;
+	}
+
+    header = &(wave->header);
+
+    if (flags & WAVE_O_WRONLY)
+    {
+        memcpy(header->riff.riffType, RIFF_TYPE, RIFF_TYPE_SIZE);
+        header->riff.riffSize = sizeof(struct WAVE_HEADER) - 8;
+        memcpy(header->riff.waveType, WAVE_TYPE, WAVE_TYPE_SIZE);
+        memcpy(header->fmts.formatType, FMTS_TYPE, FMTS_TYPE_SIZE);
+        header->fmts.formatSize = 16;
+        header->fmts.compressionCode = 1;
+        header->fmts.numChannels = attr->channels;
+        header->fmts.sampleRate = attr->samprate;
+        header->fmts.bytesPerSecond = attr->samprate * \
+			attr->channels * attr->sampbits / 8;
+        header->fmts.blockAlign = attr->channels * attr->sampbits / 8;
+        header->fmts.bitsPerSample = attr->sampbits;
+        memcpy(header->data.dataType, DATA_TYPE, DATA_TYPE_SIZE);
+        header->data.dataSize = 0;
+
+		if (wave->flags & WAVE_O_ADPCM)
+			retval = wave_adpcm_open(wave, attr, NULL);
+		else if (wave->flags & WAVE_O_LOSSLESS)
+			retval = wave_lossless_open(wave, attr, NULL);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		wave->dataOffset = wave_header_pack(wave, &image);
+
+		if ((wave->flags & WAVE_O_PREALLOC) && attr->prealloc)
+		{
+			wave->prealloc = attr->prealloc;
+			wave_file_prealloc(file, wave->dataOffset + attr->prealloc);
+		}
+
+		if (wave->flags & WAVE_O_DIRECT)
+			retval = wave_dio_open(wave);
+		else
+			wave->flags |= WAVE_O_HEADER;
+		if (retval < 0)
+			goto ERR_EXIT;
+    }
+    else
+    {
+		retval = wave_header_read(file, header, &extra);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		wave->dataOffset = retval;
+
+		if (header->fmts.compressionCode == WAVE_FORMAT_IMA_ADPCM)
+			retval = wave_adpcm_open(wave, NULL, &extra);
+		else if (header->fmts.compressionCode == WAVE_FORMAT_LOSSLESS)
+			retval = wave_lossless_open(wave, NULL, &extra);
+		if (retval < 0)
+			goto ERR_EXIT;
+    }
+
+	if (wave->flags & WAVE_O_HASH)
+	{
+		wave->hash = wave_hash_open(0);
+		if (wave->hash == NULL)
+			goto ERR_EXIT;
+	}
+
+	miniwave_dump(wave);
+	miniwave_attr((WAV)wave, attr);
+
+	return (WAV)wave;
+
+ERR_EXIT:
+	/* 先恢复状态标志再关闭, 关闭后描述符可能已被其他线程复用 */
+	if (wave)
+	{
+		if (wave->flags & WAVE_O_DIRECT)
+		{
+			wave_dio_free(wave->dio.buffer);
+			free(wave->dio.block);
+			if (!(flags & WAVE_O_INTERNAL))
+				wave_file_restore(wave);
+		}
+		if (wave->codec)
+			wave->codec->close(wave);
+		wave_hash_close(wave->hash);
+		free(wave);
+	}
+
+	if (flags & WAVE_O_INTERNAL)
+		close(file);
+
+	return (WAV)NULL;
+}
+
+int miniwave_attr(WAV wav, WAV_ATTR *attr)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
 	struct FMTS_CHUNK *fmts = NULL;
 	struct DATA_CHUNK *data = NULL;
-	int databytes = 0;
+	unsigned int offset = 0;
+
+	if ((wav == NULL) || (attr == NULL))
+	{
+		WAV_ERR("Invalid wav[%p] attr[%p]", wav, attr);
+		return -EINVAL;
+	}
+
+	if (wave->flags & WAVE_O_DIRECT)
+		offset = wave->dio.offset + wave->dio.length;
+	else if (wave->ra)
+		offset = wave->ra->position;
+	else
+		offset = lseek(wave->file, 0, SEEK_CUR);
+	if (offset < 0)
+	{
+		WAV_ERR("lseek(%d, 0, SEEK_CUR) fail[%d]", wave->file, errno);
+		return -errno;
+	}
+
+	fmts = &(wave->header.fmts);
+	data = &(wave->header.data);
+
+	attr->samprate = fmts->sampleRate;
+	attr->channels = fmts->numChannels;
+	attr->sampbits = fmts->bytesPerSecond / \
+			fmts->sampleRate / fmts->numChannels * 8;
+	attr->dataoffs = (offset > wave->dataOffset) ? \
+			(offset - wave->dataOffset) : 0;
+	attr->datasize = data->dataSize;
+	attr->prealloc = wave->prealloc;
+
+	if (wave->codec)
+		wave->codec->attr(wave, attr);
+
+	miniwave_attr_dump(attr);
+
+	return 0;
+}
+
+int miniwave_readahead(WAV wav, unsigned int depth, unsigned int size)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	struct WAVE_RA *ra = NULL;
+	off_t offset = 0;
+	unsigned int i = 0;
+	int retval = 0;
+
+	if (wav == NULL)
+	{
+		WAV_ERR("Invalid wav[%p]", wav);
+		return -EINVAL;
+	}
+
+	if (!(wave->flags & WAVE_O_RDONLY) || wave->ra)
+	{
+		WAV_ERR("Can't readahead wave file");
+		return -EPERM;
+	}
+
+	if (depth == 0)
+		depth = CONFIG_LIBRARY_MINIWAVE_READAHEAD_DEPTH;
+	if (size == 0)
+		size = CONFIG_LIBRARY_MINIWAVE_READAHEAD_SIZE;
+
+	if ((depth < 2) || (size < 512))
+	{
+		WAV_ERR("Invalid depth[%u] size[%u]", depth, size);
+		return -EINVAL;
+	}
+
+	offset = lseek(wave->file, 0, SEEK_CUR);
+	if (offset < 0)
+	{
+		WAV_ERR("lseek(%d, 0, SEEK_CUR) fail[%d]", wave->file, errno);
+		return -errno;
+	}
+
+	ra = (struct WAVE_RA *)calloc(1, sizeof(struct WAVE_RA));
+	if (ra == NULL)
+	{
+		WAV_ERR("calloc(%lu) fail", sizeof(struct WAVE_RA));
+		return -ENOMEM;
+	}
+
+	pthread_mutex_init(&ra->lock, NULL);
+	pthread_cond_init(&ra->cond, NULL);
+
+	ra->file  = wave->file;
+	ra->depth = depth;
+	ra->size  = size;
+	ra->offset   = offset;
+	ra->position = offset;
+	ra->end = wave->dataOffset + wave->header.data.dataSize;
+
+	ra->buffers = (unsigned char **)calloc(depth, sizeof(unsigned char *));
+	ra->lengths = (unsigned int *)calloc(depth, sizeof(unsigned int));
+	if ((ra->buffers == NULL) || (ra->lengths == NULL))
+	{
+		WAV_ERR("calloc(%u) fail", depth);
+		retval = -ENOMEM;
+		goto ERR_EXIT;
+	}
+
+	for (i = 0; i < depth; i++)
+	{
+		ra->buffers[i] = (unsigned char *)malloc(size);
+		if (ra->buffers[i] == NULL)
+		{
+			WAV_ERR("malloc(%u) fail", size);
+			retval = -ENOMEM;
+			goto ERR_EXIT;
+		}
+	}
+
+	/* 提示内核顺序访问, 页缓存层面同样提前读 */
+	posix_fadvise(wave->file, offset, ra->end - offset, POSIX_FADV_SEQUENTIAL);
+
+	retval = pthread_create(&ra->thread, NULL, wave_ra_thread, ra);
+	if (retval)
+	{
+		WAV_ERR("pthread_create fail[%d]", retval);
+		retval = -retval;
+		goto ERR_EXIT;
+	}
+
+	wave->ra = ra;
+
+	return 0;
+
+ERR_EXIT:
+	wave_ra_free(ra);
+
+	return retval;
+}
+
+int wave_data_read(struct WAVE *wave, void *buf, int len)
+{
+	struct DATA_CHUNK *data = &(wave->header.data);
+	int offset = 0;
+	int retval = 0;
+
+	if (wave->ra)
+		return wave_ra_read(wave->ra, buf, len);
+
+	offset = lseek(wave->file, 0, SEEK_CUR);
+	if (offset < 0)
+	{
+		WAV_ERR("lseek(%d, 0, SEEK_CUR) fail[%d]", wave->file, errno);
+		return -errno;
+	}
+
+	if (offset >= (wave->dataOffset + data->dataSize))
+	{
+		WAV_INF("end of read wave file");
+		return 0;
+	}
+
+	if (len > (data->dataSize + wave->dataOffset - offset))
+		len = (data->dataSize + wave->dataOffset - offset);
+
+	retval = read(wave->file, buf, len);
+	if (retval < 0)
+	{
+		WAV_ERR("read(%d, %p, %d) fail[%d]", wave->file, buf, len, errno);
+		return -errno;
+	}
+
+	return retval;
+}
+
+int wave_data_seek(struct WAVE *wave, off_t offset)
+{
+	unsigned int depth = 0;
+	unsigned int size = 0;
+
+	/* 预读线程按原参数在新位置重新启动 */
+	if (wave->ra)
+	{
+		depth = wave->ra->depth;
+		size  = wave->ra->size;
+		wave_ra_close(wave->ra);
+		wave->ra = NULL;
+	}
+
+	if (lseek(wave->file, offset, SEEK_SET) < 0)
+	{
+		WAV_ERR("lseek(%d, %ld, SEEK_SET) fail[%d]", wave->file, (long)offset, errno);
+		return -errno;
+	}
+
+	if (depth)
+		return miniwave_readahead((WAV)wave, depth, size);
+
+	return 0;
+}
+
+int miniwave_seek(WAV wav, unsigned int frame)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	struct FMTS_CHUNK *fmts = NULL;
+	unsigned int size = 0;
+
+	if (wav == NULL)
+	{
+		WAV_ERR("Invalid wav[%p]", wav);
+		return -EINVAL;
+	}
+
+	if (!(wave->flags & WAVE_O_RDONLY))
+	{
+		WAV_ERR("Can't seek wave file");
+		return -EPERM;
+	}
+
+	/* 回到开头重新计算, 跳读后的结果不代表完整payload */
+	if (wave->hash)
+		wave_hash_reset(wave->hash, frame != 0);
+
+	if (wave->codec)
+		return wave->codec->seek(wave, frame);
+
+	fmts = &(wave->header.fmts);
+	size = fmts->bytesPerSecond / fmts->sampleRate;
+	if (size == 0)
+		return -EINVAL;
+
+	if (frame > wave->header.data.dataSize / size)
+		frame = wave->header.data.dataSize / size;
+
+	return wave_data_seek(wave, wave->dataOffset + (off_t)frame * size);
+}
+
+int miniwave_read(WAV wav, void *buf, int len)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	int retval = 0;
+
+	if ((wav == NULL) || (buf == NULL) || (len <= 0))
+	{
+		WAV_ERR("Invalid wav[%p] buf[%p] len[%d]", wav, buf, len);
+		return -EINVAL;
+	}
+
+	if (!(wave->flags & WAVE_O_RDONLY))
+	{
+		WAV_ERR("Can't read wave file");
+		return -EPERM;
+	}
+
+	retval = wave_frame_check(wave, len);
+	if (retval < 0)
+		return retval;
+
+	if (wave->codec)
+		retval = wave->codec->read(wave, buf, len);
+	else
+		retval = wave_data_read(wave, buf, len);
+
+	if (wave->hash && (retval > 0))
+		wave_hash_update(wave->hash, buf, retval);
+
+	return retval;
+}
+
+/*
+ * 编解码器只收发整帧, 缓冲区边界切开一帧时经过帧对齐的中转缓冲区;
+ * 每个缓冲区都是整帧时直接逐个收发, 不多一次拷贝.
+ */
+static int wave_codec_iov(struct WAVE *wave, const struct iovec *iov, int iovcnt, unsigned int frame, int write)
+{
+	unsigned char *stage = NULL;
+	unsigned char *base = NULL;
+	unsigned int size = 0;
+	unsigned int used = 0;
+	unsigned int fill = 0;
+	size_t offset = 0;
+	int len = 0;
+	int i = 0;
+	int retval = 0;
+
+	for (i = 0; i < iovcnt; i++)
+	{
+		if (iov[i].iov_len % frame)
+			break;
+	}
+
+	if (i == iovcnt)
+	{
+		for (i = 0; i < iovcnt; i++)
+		{
+			if (iov[i].iov_len == 0)
+				continue;
+
+			if (write)
+				retval = wave->codec->write(wave, iov[i].iov_base, iov[i].iov_len);
+			else
+				retval = wave->codec->read(wave, iov[i].iov_base, iov[i].iov_len);
+			if (retval < 0)
+				return len ? len : retval;
+
+			len += retval;
+			if (retval < iov[i].iov_len)
+				break;
+		}
+
+		return len;
+	}
+
+	size = (WAVE_IOV_STAGE > frame) ? (WAVE_IOV_STAGE / frame * frame) : frame;
+
+	stage = (unsigned char *)malloc(size);
+	if (stage == NULL)
+	{
+		WAV_ERR("malloc(%u) fail", size);
+		return -ENOMEM;
+	}
+
+	for (i = 0, offset = 0; i < iovcnt; )
+	{
+		/* 写: 从用户缓冲区收集满一个中转区再编码; 读: 解码一个中转区再分发 */
+		if (!write)
+		{
+			fill = wave_iov_length(iov + i, iovcnt - i) - offset;
+			if (fill > size)
+				fill = size;
+
+			retval = wave->codec->read(wave, stage, fill);
+			if (retval <= 0)
+				break;
+			fill = retval;
+		}
+		else
+			fill = size;
+
+		for (used = 0; (used < fill) && (i < iovcnt); )
+		{
+			unsigned int count = iov[i].iov_len - offset;
+
+			if (count > fill - used)
+				count = fill - used;
+
+			base = (unsigned char *)iov[i].iov_base + offset;
+			if (write)
+				memcpy(stage + used, base, count);
+			else
+				memcpy(base, stage + used, count);
+
+			used += count;
+			offset += count;
+			if (offset == iov[i].iov_len)
+			{
+				i++;
+				offset = 0;
+			}
+		}
+
+		if (write)
+		{
+			retval = wave->codec->write(wave, stage, used);
+			if (retval <= 0)
+				break;
+		}
+
+		len += retval;
+		if (retval < used)
+			break;
+	}
+
+	free(stage);
+
+	if (retval < 0)
+		return len ? len : retval;
+
+	return len;
+}
+
+static int wave_iov_read(WAV wav, const struct iovec *iov, int iovcnt)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	struct DATA_CHUNK *data = NULL;
+	unsigned int remain = 0;
+	int offset = 0;
+	int len = 0;
+	int size = 0;
+	int i = 0;
+	int retval = 0;
+
+	len = wave_iov_length(iov, iovcnt);
+	if ((wav == NULL) || (len <= 0))
+	{
+		WAV_ERR("Invalid wav[%p] iov[%p] iovcnt[%d]", wav, iov, iovcnt);
+		return -EINVAL;
+	}
+
+	if (!(wave->flags & WAVE_O_RDONLY))
+	{
+		WAV_ERR("Can't read wave file");
+		return -EPERM;
+	}
+
+	data = &(wave->header.data);
+
+	retval = wave_frame_check(wave, len);
+	if (retval < 0)
+		return retval;
+
+	if (wave->codec)
+		return wave_codec_iov(wave, iov, iovcnt, retval, 0);
+
+	/* 预读从内存拷贝, 逐个缓冲区填充 */
+	if (wave->ra)
+	{
+		for (i = 0, len = 0; i < iovcnt; i++)
+		{
+			if (iov[i].iov_len == 0)
+				continue;
+
+			retval = wave_ra_read(wave->ra, iov[i].iov_base, iov[i].iov_len);
+			if (retval < 0)
+				return len ? len : retval;
+
+			len += retval;
+			if (retval < iov[i].iov_len)
+				break;
+		}
+
+		return len;
+	}
+
+	offset = lseek(wave->file, 0, SEEK_CUR);
+	if (offset < 0)
+	{
+		WAV_ERR("lseek(%d, 0, SEEK_CUR) fail[%d]", wave->file, errno);
+		return -errno;
+	}
+
+	if (offset >= (wave->dataOffset + data->dataSize))
+	{
+		WAV_INF("end of read wave file");
+		return 0;
+	}
+
+	remain = data->dataSize + wave->dataOffset - offset;
+	if (len <= remain)
+	{
+		retval = readv(wave->file, iov, iovcnt);
+		if (retval < 0)
+		{
+			WAV_ERR("readv(%d, %p, %d) fail[%d]", wave->file, iov, iovcnt, errno);
+			return -errno;
+		}
+
+		return retval;
+	}
+
+	/* 数据块尾部: 完整容纳的缓冲区一次readv, 最后一个截断的单独read */
+	for (i = 0, size = 0; i < iovcnt; i++)
+	{
+		if (size + iov[i].iov_len > remain)
+			break;
+		size += iov[i].iov_len;
+	}
+
+	len = 0;
+	if (i > 0)
+	{
+		retval = readv(wave->file, iov, i);
+		if (retval < 0)
+		{
+			WAV_ERR("readv(%d, %p, %d) fail[%d]", wave->file, iov, i, errno);
+			return -errno;
+		}
+
+		len = retval;
+		if (retval < size)
+			return len;
+	}
+
+	if (remain > size)
+	{
+		retval = read(wave->file, iov[i].iov_base, remain - size);
+		if (retval < 0)
+		{
+			WAV_ERR("read(%d, %p, %u) fail[%d]",
+				wave->file, iov[i].iov_base, remain - size, errno);
+			return len ? len : -errno;
+		}
+
+		len += retval;
+	}
+
+	return len;
+}
+
+int miniwave_readv(WAV wav, const struct iovec *iov, int iovcnt)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	int retval = 0;
+
+	retval = wave_iov_read(wav, iov, iovcnt);
+	if ((retval > 0) && wave->hash)
+		wave_hash_updatev(wave->hash, iov, iovcnt, retval);
+
+	return retval;
+}
+
+int wave_data_writev(struct WAVE *wave, const struct iovec *iov, int iovcnt)
+{
+	struct RIFF_CHUNK *riff = &(wave->header.riff);
+	struct FMTS_CHUNK *fmts = &(wave->header.fmts);
+	struct DATA_CHUNK *data = &(wave->header.data);
 	int second = 0;
+	int len = 0;
+	int retval = 0;
+	int i = 0;
+
+	if (wave->flags & WAVE_O_DIRECT)
+	{
+		for (i = 0, len = 0; i < iovcnt; i++)
+		{
+			if (iov[i].iov_len == 0)
+				continue;
+
+			retval = wave_dio_write(wave, iov[i].iov_base, iov[i].iov_len);
+			if (retval < 0)
+				return len ? len : retval;
+
+			/* 头部在关闭时统一回写 */
+			riff->riffSize += retval;
+			data->dataSize += retval;
+			len += retval;
+
+			if (retval < iov[i].iov_len)
+				break;
+		}
+
+		return len;
+	}
+
+	if (wave->flags & WAVE_O_HEADER)
+	{
+		unsigned int size = 0;
+		void *image = NULL;
+
+		size = wave_header_pack(wave, &image);
+
+		retval = wave_header_writev(wave->file, image, size, iov, iovcnt);
+		if (retval < 0)
+			return retval;
+
+		wave->flags &= ~WAVE_O_HEADER;
+	}
+	else
+	{
+		retval = writev(wave->file, iov, iovcnt);
+		if (retval < 0)
+		{
+			WAV_ERR("writev(%d, %p, %d) fail[%d]", wave->file, iov, iovcnt, errno);
+			return -errno;
+		}
+	}
+
+	second = data->dataSize / fmts->bytesPerSecond;
+
+	riff->riffSize += retval;
+	data->dataSize += retval;
+
+	if ((data->dataSize / fmts->bytesPerSecond) != second)
+	{
+		wave_header_flush(wave);
+	}
+
+	return retval;
+}
+
+int wave_data_write(struct WAVE *wave, const void *buf, int len)
+{
+	struct iovec iov = {(void *)buf, len};
+
+	return wave_data_writev(wave, &iov, 1);
+}
+
+/* data块之后追加一个块, 不计入dataSize; 前面内容为奇数长度时补一个字节 */
+int wave_trailer_write(struct WAVE *wave, const char *type, const void *payload, unsigned int size)
+{
+	struct DATA_CHUNK chunk;
+	unsigned char *trailer = NULL;
+	unsigned int pad = 0;
+	unsigned int length = 0;
+	int retval = 0;
+
+	pad = (wave->header.data.dataSize + wave->trailer) & 1;
+	length = pad + DATA_CHUNK_SIZE + size;
+
+	trailer = (unsigned char *)calloc(1, length);
+	if (trailer == NULL)
+	{
+		WAV_ERR("calloc(%u) fail", length);
+		return -ENOMEM;
+	}
+
+	memcpy(chunk.dataType, type, 4);
+	chunk.dataSize = size;
+	memcpy(trailer + pad, &chunk, DATA_CHUNK_SIZE);
+	memcpy(trailer + pad + DATA_CHUNK_SIZE, payload, size);
+
+	retval = wave_data_write(wave, trailer, length);
+	if (retval >= 0)
+	{
+		wave->header.data.dataSize -= retval;
+		wave->header.riff.riffSize -= retval;
+		wave->trailer += retval;
+		retval = 0;
+	}
+
+	free(trailer);
+
+	return retval;
+}
+
+int miniwave_write(WAV wav, void *buf, int len)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
 	int retval = 0;
 
 	if ((wav == NULL) || (buf == NULL) || (len <= 0))
@@ -531,50 +1610,343 @@ int miniwave_write(WAV wav, void *buf, int len)
 		return -EPERM;
 	}
 
-	riff = &(wave->header.riff);
+	retval = wave_frame_check(wave, len);
+	if (retval < 0)
+		return retval;
+
+	if (wave->cap)
+	{
+		WAV_ERR("Wave file is capturing");
+		return -EBUSY;
+	}
+
+	if (wave->codec)
+		retval = wave->codec->write(wave, buf, len);
+	else
+		retval = wave_data_write(wave, buf, len);
+
+	if (wave->hash && (retval > 0))
+		wave_hash_update(wave->hash, buf, retval);
+
+	return retval;
+}
+
+static int wave_iov_write(WAV wav, const struct iovec *iov, int iovcnt)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	int len = 0;
+	int retval = 0;
+
+	len = wave_iov_length(iov, iovcnt);
+	if ((wav == NULL) || (len <= 0))
+	{
+		WAV_ERR("Invalid wav[%p] iov[%p] iovcnt[%d]", wav, iov, iovcnt);
+		return -EINVAL;
+	}
+
+	if (!(wave->flags & WAVE_O_WRONLY))
+	{
+		WAV_ERR("Can't write wave file");
+		return -EPERM;
+	}
+
+	retval = wave_frame_check(wave, len);
+	if (retval < 0)
+		return retval;
+
+	if (wave->cap)
+	{
+		WAV_ERR("Wave file is capturing");
+		return -EBUSY;
+	}
+
+	if (wave->codec)
+		return wave_codec_iov(wave, iov, iovcnt, retval, 1);
+
+	return wave_data_writev(wave, iov, iovcnt);
+}
+
+int miniwave_writev(WAV wav, const struct iovec *iov, int iovcnt)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	int retval = 0;
+
+	retval = wave_iov_write(wav, iov, iovcnt);
+	if ((retval > 0) && wave->hash)
+		wave_hash_updatev(wave->hash, iov, iovcnt, retval);
+
+	return retval;
+}
+
+/*
+ * 实时采集: 音频回调线程把帧推入单生产者/单消费者无锁环形缓冲区,
+ * 推入过程不加锁不调用系统调用, 写盘线程批量取出并写文件和更新头部.
+ */
+static void *wave_cap_thread(void *arg)
+{
+	struct WAVE_CAP *cap = (struct WAVE_CAP *)arg;
+	unsigned int head = 0;
+	unsigned int used = 0;
+	unsigned int size = 0;
+	int idle = 0;
+	int stop = 0;
+	int retval = 0;
+
+	for (;;)
+	{
+		/* 先读stop再读head, 保证退出前看到停止前推入的全部数据 */
+		stop = __atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&cap->head, __ATOMIC_ACQUIRE);
+		used = (head + cap->size - cap->tail) % cap->size;
+
+		if (used == 0)
+		{
+			if (stop)
+				break;
+
+			usleep(cap->period);
+			continue;
+		}
+
+		if ((used < cap->batch) && !stop && (++idle < 4))
+		{
+			usleep(cap->period);
+			continue;
+		}
+
+		idle = 0;
+
+		size = cap->size - cap->tail;
+		if (size > used)
+			size = used;
+
+		if (cap->wave->codec)
+			retval = cap->wave->codec->write(cap->wave, cap->buffer + cap->tail, size);
+		else
+			retval = wave_data_write(cap->wave, cap->buffer + cap->tail, size);
+		/* 写失败丢弃本段计入dropped, 避免卡住生产者; 短写只推进实际写入的字节, 余下的下一轮重试 */
+		if (retval <= 0)
+		{
+			__atomic_add_fetch(&cap->stat.errors, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&cap->stat.dropped, size, __ATOMIC_RELAXED);
+			retval = size;
+		}
+		else
+		{
+			__atomic_add_fetch(&cap->stat.written, retval, __ATOMIC_RELAXED);
+
+			if (cap->wave->hash)
+				wave_hash_update(cap->wave->hash, cap->buffer + cap->tail, retval);
+		}
+
+		__atomic_store_n(&cap->tail, (cap->tail + retval) % cap->size, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+int miniwave_capture_start(WAV wav, unsigned int size)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	struct FMTS_CHUNK *fmts = NULL;
+	struct WAVE_CAP *cap = NULL;
+	unsigned int frame = 0;
+	unsigned long long period = 0;
+	int retval = 0;
+
+	if ((wav == NULL) || (size == 0))
+	{
+		WAV_ERR("Invalid wav[%p] size[%u]", wav, size);
+		return -EINVAL;
+	}
+
+	if (!(wave->flags & WAVE_O_WRONLY) || wave->cap)
+	{
+		WAV_ERR("Can't capture wave file");
+		return -EPERM;
+	}
+
 	fmts = &(wave->header.fmts);
-	data = &(wave->header.data);
 
-	databytes = fmts->bytesPerSecond / \
-				fmts->sampleRate / \
-				fmts->numChannels;
+	if (wave->codec)
+	{
+		WAV_ATTR attr;
 
-	if (databytes <= 0 || databytes > 4)
+		memset(&attr, 0, sizeof(WAV_ATTR));
+		wave->codec->attr(wave, &attr);
+		frame = fmts->numChannels * attr.sampbits / 8;
+	}
+	else
+		frame = fmts->bytesPerSecond / fmts->sampleRate;
+	if (frame == 0)
 	{
-		WAV_ERR("Invald databytes[%d]", databytes);
+		WAV_ERR("Invalid bytesPerSecond[%u] sampleRate[%u]",
+			fmts->bytesPerSecond, fmts->sampleRate);
 		return -EINVAL;
 	}
 
-	if (len % (databytes * fmts->numChannels))
+	cap = (struct WAVE_CAP *)calloc(1, sizeof(struct WAVE_CAP));
+	if (cap == NULL)
 	{
-		WAV_ERR("Invalid len[%d] databytes[%d] channels[%u]",
-			len, databytes, fmts->numChannels);
+		WAV_ERR("calloc(%lu) fail", sizeof(struct WAVE_CAP));
+		return -ENOMEM;
+	}
+
+	cap->wave  = wave;
+	cap->frame = frame;
+	cap->size  = (size + frame - 1) / frame * frame + frame;
+	cap->batch = (cap->size / 4) / frame * frame;
+	if (cap->batch == 0)
+		cap->batch = frame;
+
+	/* 按码率估算填满一个批次的一半时间, 限制在1ms~50ms */
+	period = (unsigned long long)cap->batch * 500000 / fmts->bytesPerSecond;
+	if (period < 1000)
+		period = 1000;
+	if (period > 50000)
+		period = 50000;
+	cap->period = (unsigned int)period;
+
+	cap->buffer = (unsigned char *)malloc(cap->size);
+	if (cap->buffer == NULL)
+	{
+		WAV_ERR("malloc(%u) fail", cap->size);
+		free(cap);
+		return -ENOMEM;
+	}
+
+	/* 预先触碰全部页面, 避免回调线程里发生缺页 */
+	memset(cap->buffer, 0, cap->size);
+
+	retval = pthread_create(&cap->thread, NULL, wave_cap_thread, cap);
+	if (retval)
+	{
+		WAV_ERR("pthread_create fail[%d]", retval);
+		free(cap->buffer);
+		free(cap);
+		return -retval;
+	}
+
+	wave->cap = cap;
+
+	return 0;
+}
+
+int miniwave_capture_push(WAV wav, const void *buf, int len)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	struct WAVE_CAP *cap = NULL;
+	unsigned int head = 0;
+	unsigned int tail = 0;
+	unsigned int used = 0;
+	unsigned int size = 0;
+
+	if ((wav == NULL) || (wave->cap == NULL) || (buf == NULL) || (len <= 0))
+		return -EINVAL;
+
+	cap = wave->cap;
+
+	if (len % cap->frame)
 		return -EINVAL;
+
+	head = cap->head;
+	tail = __atomic_load_n(&cap->tail, __ATOMIC_ACQUIRE);
+	used = (head + cap->size - tail) % cap->size;
+
+	if (len > cap->size - cap->frame - used)
+	{
+		__atomic_add_fetch(&cap->stat.overruns, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&cap->stat.dropped, len, __ATOMIC_RELAXED);
+		return -ENOSPC;
 	}
 
-	retval = write(wave->file, buf, len);
-	if (retval < 0)
+	size = cap->size - head;
+	if (size > len)
+		size = len;
+
+	memcpy(cap->buffer + head, buf, size);
+	memcpy(cap->buffer, (const unsigned char *)buf + size, len - size);
+
+	__atomic_store_n(&cap->head, (head + len) % cap->size, __ATOMIC_RELEASE);
+
+	used += len;
+	if (used > cap->stat.maxfill)
+		__atomic_store_n(&cap->stat.maxfill, used, __ATOMIC_RELAXED);
+
+	return len;
+}
+
+int miniwave_capture_stat(WAV wav, WAV_CAPTURE_STAT *stat)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	struct WAVE_CAP *cap = NULL;
+
+	if ((wav == NULL) || (stat == NULL))
 	{
-		WAV_ERR("write(%d, %p, %d) fail[%d]", wave->file, buf, len, errno);
-		return -errno;
+		WAV_ERR("Invalid wav[%p] stat[%p]", wav, stat);
+		return -EINVAL;
 	}
 
-	second = data->dataSize / fmts->bytesPerSecond;
+	/* 停止后返回最近一次录音的最终统计 */
+	if (wave->cap == NULL)
+	{
+		memcpy(stat, &(wave->capstat), sizeof(WAV_CAPTURE_STAT));
+		return 0;
+	}
 
-	riff->riffSize += retval;
-	data->dataSize += retval;
+	cap = wave->cap;
 
-	if ((data->dataSize / fmts->bytesPerSecond) != second)
+	stat->overruns = __atomic_load_n(&cap->stat.overruns, __ATOMIC_RELAXED);
+	stat->dropped  = __atomic_load_n(&cap->stat.dropped, __ATOMIC_RELAXED);
+	stat->maxfill  = __atomic_load_n(&cap->stat.maxfill, __ATOMIC_RELAXED);
+	stat->written  = __atomic_load_n(&cap->stat.written, __ATOMIC_RELAXED);
+	stat->errors   = __atomic_load_n(&cap->stat.errors, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+int miniwave_capture_stop(WAV wav)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+	struct WAVE_CAP *cap = NULL;
+
+	if ((wav == NULL) || (wave->cap == NULL))
 	{
-		wave_header_write(wave->file, &(wave->header));
+		WAV_ERR("Invalid wav[%p]", wav);
+		return -EINVAL;
 	}
 
-	return retval;
+	cap = wave->cap;
+
+	__atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(cap->thread, NULL);
+
+	WAV_INF("capture overruns[%u] dropped[%u] maxfill[%u] written[%u] errors[%u]",
+		cap->stat.overruns, cap->stat.dropped, cap->stat.maxfill,
+		cap->stat.written, cap->stat.errors);
+
+	memcpy(&(wave->capstat), &(cap->stat), sizeof(WAV_CAPTURE_STAT));
+	wave->cap = NULL;
+
+	free(cap->buffer);
+	free(cap);
+
+	/* 有数据没有落盘, 录音结果不完整 */
+	if (wave->capstat.errors || wave->capstat.dropped)
+	{
+		WAV_ERR("capture lost data, dropped[%u] errors[%u]",
+			wave->capstat.dropped, wave->capstat.errors);
+		return -EIO;
+	}
+
+	return 0;
 }
 
 int miniwave_close(WAV wav)
 {
 	struct WAVE *wave = (struct WAVE *)wav;
+	int result = 0;
+	int retval = 0;
 
 	if (wav == NULL)
 	{
@@ -582,14 +1954,59 @@ int miniwave_close(WAV wav)
 		return -EINVAL;
 	}
 
-	if (wave->flags & WAVE_O_WRONLY)
-		wave_header_write(wave->file, &(wave->header));
+	if (wave->ra)
+		wave_ra_close(wave->ra);
+
+	if (wave->cap)
+		result = miniwave_capture_stop(wav);
+
+	/* 编码器缓冲的最后一块数据落盘 */
+	if (wave->codec && (wave->flags & WAVE_O_WRONLY))
+	{
+		retval = wave->codec->flush(wave);
+		if ((retval < 0) && (result == 0))
+			result = retval;
+	}
+
+	if (wave->hash && (wave->flags & WAVE_O_WRONLY))
+	{
+		retval = wave_hash_flush(wave);
+		if ((retval < 0) && (result == 0))
+			result = retval;
+	}
+
+	/* 出错也继续回写头部和释放资源, 返回最先出现的错误 */
+	if (wave->flags & WAVE_O_DIRECT)
+	{
+		retval = wave_dio_close(wave);
+		if ((retval < 0) && (result == 0))
+			result = retval;
+
+		if (!(wave->flags & WAVE_O_INTERNAL))
+			retval = wave_file_restore(wave);
+	}
+	else if (wave->flags & WAVE_O_WRONLY)
+		retval = wave_header_flush(wave);
+	if ((retval < 0) && (result == 0))
+		result = retval;
+
+	/* 释放预分配但未写入的区段 */
+	if (wave->prealloc && !(wave->flags & WAVE_O_DIRECT))
+	{
+		if (ftruncate(wave->file, wave->dataOffset + wave->header.data.dataSize + wave->trailer) < 0)
+			WAV_WRN("ftruncate(%d) fail[%d]", wave->file, errno);
+	}
 
 	if (wave->flags & WAVE_O_INTERNAL)
 		close(wave->file);
 
+	if (wave->codec)
+		wave->codec->close(wave);
+
+	wave_hash_close(wave->hash);
+
 	if (wave)
 		free(wave);
 
-	return 0;
+	return result;
 }
@@ -7,6 +7,12 @@
 #ifndef __TEMPLATE_H__
 #define __TEMPLATE_H__
 
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 typedef void* WAV;
 
 typedef struct
@@ -16,10 +22,63 @@ typedef struct
     unsigned int channels;
     unsigned int dataoffs;
     unsigned int datasize;
+    unsigned int prealloc;  // expected data size in bytes, used with WAVE_O_PREALLOC
 } WAV_ATTR;
 
+typedef struct
+{
+    unsigned int overruns;  // push calls dropped because the ring was full
+    unsigned int dropped;   // bytes dropped by overruns and failed writes
+    unsigned int maxfill;   // ring high watermark in bytes
+    unsigned int written;   // bytes written by the writer thread
+    unsigned int errors;    // failed writes in the writer thread
+} WAV_CAPTURE_STAT;
+
+#define WAVE_PEAKS_LEVELS   8
+
+typedef void* WAV_PEAKS;
+
+typedef struct
+{
+    short min;
+    short max;
+    unsigned short rms;
+} WAV_PEAK;
+
+typedef struct
+{
+    double peak;        // sample peak in dBFS, -HUGE_VAL when silent
+    double loudness;    // integrated loudness in LUFS (ITU-R BS.1770), -HUGE_VAL when silent
+    double gain;        // gain applied by miniwave_normalize() in dB
+} WAV_LEVEL;
+
+typedef struct
+{
+    unsigned int start;     // first frame of the region
+    unsigned int frames;    // region length in frames
+} WAV_REGION;
+
+typedef struct
+{
+    unsigned long long root;    // tree hash of the PCM payload
+    unsigned long long bytes;   // PCM payload bytes covered
+    unsigned int leaves;        // number of 1MiB leaf segments
+} WAV_HASH;
+
+#define WAVE_NORM_PEAK      0   // normalize the sample peak to target dBFS
+#define WAVE_NORM_LOUDNESS  1   // normalize the integrated loudness to target LUFS
+
 #define WAVE_O_RDONLY   (1 << 0)
 #define WAVE_O_WRONLY   (1 << 1)
+#define WAVE_O_PREALLOC (1 << 2)    // reserve attr->prealloc bytes with fallocate()
+#define WAVE_O_DIRECT   (1 << 3)    // write through O_DIRECT with aligned buffers
+#define WAVE_O_ADPCM    (1 << 4)    // encode PCM16 input as IMA ADPCM
+#define WAVE_O_LOSSLESS (1 << 5)    // encode PCM input with the lossless LPC/Rice codec
+#define WAVE_O_HASH     (1 << 6)    // hash the PCM payload while reading/writing, stored as a "hash" chunk on close
+
+#define WAVE_PREALLOC_SIZE(attr, ms) \
+    ((unsigned int)((unsigned long long)(attr)->samprate * \
+    (attr)->channels * ((attr)->sampbits / 8) * (ms) / 1000))
 
 void miniwave_version(char *name, int *major, int *minor, char *date);
 
@@ -29,10 +88,67 @@ WAV miniwave_open_with_file(int file, int flags, WAV_ATTR *attr);
 
 int miniwave_attr(WAV wav, WAV_ATTR *attr);
 
+int miniwave_readahead(WAV wav, unsigned int depth, unsigned int size);
+
 int miniwave_read(WAV wav, void *buf, int len);
 
+int miniwave_readv(WAV wav, const struct iovec *iov, int iovcnt);
+
+int miniwave_seek(WAV wav, unsigned int frame);
+
 int miniwave_write(WAV wav, void *buf, int len);
 
+int miniwave_writev(WAV wav, const struct iovec *iov, int iovcnt);
+
+int miniwave_capture_start(WAV wav, unsigned int size);
+
+int miniwave_capture_push(WAV wav, const void *buf, int len);
+
+// After miniwave_capture_stop() returns the final counters of the last capture.
+int miniwave_capture_stat(WAV wav, WAV_CAPTURE_STAT *stat);
+
+// -EIO when the writer dropped data or failed to write; miniwave_close() passes it on.
+int miniwave_capture_stop(WAV wav);
+
 int miniwave_close(WAV wav);
 
+int miniwave_trim(const char *iname, const char *oname, unsigned int start, unsigned int frames);
+
+int miniwave_concat(const char *oname, const char **inames, int count);
+
+WAV_PEAKS miniwave_peaks_open(const char *name, const char *cache,
+                const unsigned int *decimation, int levels);
+
+int miniwave_peaks_info(WAV_PEAKS peaks, int level, unsigned int *decimation, unsigned int *bins);
+
+// buf holds count * channels entries (channels from miniwave_peaks_info()), each bin
+// interleaved by channel; returns the number of bins read.
+int miniwave_peaks_read(WAV_PEAKS peaks, int level, unsigned int bin, unsigned int count, WAV_PEAK *buf);
+
+int miniwave_peaks_close(WAV_PEAKS peaks);
+
+int miniwave_level(const char *name, WAV_LEVEL *level);
+
+// In-place gain/normalize also rewrite a stored "hash" chunk to match the new payload.
+int miniwave_gain(const char *name, double gain);
+
+int miniwave_normalize(const char *name, int mode, double target, double ceiling, WAV_LEVEL *level);
+
+int miniwave_silence_scan(WAV wav, double threshold, unsigned int minimum, WAV_REGION *regions, int count);
+
+int miniwave_silence_trim(const char *iname, const char *oname, double threshold, unsigned int minimum);
+
+// -EBUSY while capturing; query after miniwave_capture_stop().
+int miniwave_hash(WAV wav, WAV_HASH *hash);
+
+int miniwave_hash_file(const char *name, WAV_HASH *hash);
+
+int miniwave_hash_stored(const char *name, WAV_HASH *hash);
+
+int miniwave_hash_verify(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
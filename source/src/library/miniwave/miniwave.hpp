@@ -0,0 +1,491 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __MINIWAVE_HPP__
+#define __MINIWAVE_HPP__
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus > 201703L && defined(__has_include)
+#if __has_include(<span>)
+#include <span>
+#define MINIWAVE_STD_SPAN 1
+#endif
+#endif
+
+#include "miniwave.h"
+
+namespace miniwave {
+
+// Channel count only known when the file is opened.
+constexpr std::size_t dynamic_channels = 0;
+
+#ifdef MINIWAVE_STD_SPAN
+template <typename T>
+using span = std::span<T>;
+#else
+// Minimal std::span stand-in for C++17.
+template <typename T>
+class span
+{
+public:
+    using element_type = T;
+    using value_type = typename std::remove_cv<T>::type;
+    using size_type = std::size_t;
+    using pointer = T *;
+    using reference = T &;
+    using iterator = T *;
+
+    constexpr span() noexcept = default;
+    constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+    template <typename U, typename = typename std::enable_if<
+        std::is_convertible<U (*)[], T (*)[]>::value>::type>
+    constexpr span(const span<U> &other) noexcept : data_(other.data()), size_(other.size()) {}
+
+    template <typename Container, typename = decltype(std::declval<Container &>().data())>
+    constexpr span(Container &c) noexcept : data_(c.data()), size_(c.size()) {}
+
+    constexpr T *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr std::size_t size_bytes() const noexcept { return size_ * sizeof(T); }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+    constexpr T *begin() const noexcept { return data_; }
+    constexpr T *end() const noexcept { return data_ + size_; }
+
+    constexpr span first(std::size_t count) const noexcept { return span(data_, count); }
+    constexpr span subspan(std::size_t offset, std::size_t count) const noexcept
+    {
+        return span(data_ + offset, count);
+    }
+
+private:
+    T *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+#endif
+
+namespace detail {
+
+// Sample types the reader/writer hand out; 'bits' is the PCM width used by default.
+template <typename SampleT> struct sample_traits;
+template <> struct sample_traits<std::uint8_t> { static constexpr unsigned bits = 8; };
+template <> struct sample_traits<std::int16_t> { static constexpr unsigned bits = 16; };
+template <> struct sample_traits<std::int32_t> { static constexpr unsigned bits = 32; };
+template <> struct sample_traits<float>        { static constexpr unsigned bits = 24; };
+
+// True when the on-disk layout already is SampleT and no conversion is needed.
+template <typename SampleT, unsigned Bits>
+inline constexpr bool native = (Bits == 8 && std::is_same<SampleT, std::uint8_t>::value) ||
+                        (Bits == 16 && std::is_same<SampleT, std::int16_t>::value) ||
+                        (Bits == 32 && std::is_same<SampleT, std::int32_t>::value);
+
+// Little-endian PCM sample to a left-aligned 32bit value.
+template <unsigned Bits>
+inline std::int32_t load(const unsigned char *p) noexcept
+{
+    if constexpr (Bits == 8)
+        return static_cast<std::int32_t>(static_cast<std::uint32_t>(p[0] ^ 0x80) << 24);
+    else if constexpr (Bits == 16)
+        return static_cast<std::int32_t>((static_cast<std::uint32_t>(p[0]) << 16) |
+                                         (static_cast<std::uint32_t>(p[1]) << 24));
+    else if constexpr (Bits == 24)
+        return static_cast<std::int32_t>((static_cast<std::uint32_t>(p[0]) << 8) |
+                                         (static_cast<std::uint32_t>(p[1]) << 16) |
+                                         (static_cast<std::uint32_t>(p[2]) << 24));
+    else
+        return static_cast<std::int32_t>(static_cast<std::uint32_t>(p[0]) |
+                                         (static_cast<std::uint32_t>(p[1]) << 8) |
+                                         (static_cast<std::uint32_t>(p[2]) << 16) |
+                                         (static_cast<std::uint32_t>(p[3]) << 24));
+}
+
+template <unsigned Bits>
+inline void store(unsigned char *p, std::int32_t v) noexcept
+{
+    std::uint32_t u = static_cast<std::uint32_t>(v);
+
+    if constexpr (Bits == 8)
+    {
+        p[0] = static_cast<unsigned char>((u >> 24) ^ 0x80);
+    }
+    else if constexpr (Bits == 16)
+    {
+        p[0] = static_cast<unsigned char>(u >> 16);
+        p[1] = static_cast<unsigned char>(u >> 24);
+    }
+    else if constexpr (Bits == 24)
+    {
+        p[0] = static_cast<unsigned char>(u >> 8);
+        p[1] = static_cast<unsigned char>(u >> 16);
+        p[2] = static_cast<unsigned char>(u >> 24);
+    }
+    else
+    {
+        p[0] = static_cast<unsigned char>(u);
+        p[1] = static_cast<unsigned char>(u >> 8);
+        p[2] = static_cast<unsigned char>(u >> 16);
+        p[3] = static_cast<unsigned char>(u >> 24);
+    }
+}
+
+// Left-aligned 32bit value to SampleT and back; float is full scale [-1, 1).
+template <typename SampleT>
+inline SampleT from_aligned(std::int32_t v) noexcept
+{
+    if constexpr (std::is_same<SampleT, float>::value)
+        return static_cast<float>(v) * (1.0f / 2147483648.0f);
+    else if constexpr (std::is_same<SampleT, std::uint8_t>::value)
+        return static_cast<std::uint8_t>((static_cast<std::uint32_t>(v) >> 24) ^ 0x80);
+    else
+        return static_cast<SampleT>(v >> (32 - 8 * sizeof(SampleT)));
+}
+
+template <typename SampleT>
+inline std::int32_t to_aligned(SampleT s) noexcept
+{
+    if constexpr (std::is_same<SampleT, float>::value)
+    {
+        float v = s * 2147483648.0f;
+
+        v = (v < -2147483648.0f) ? -2147483648.0f : v;
+        v = (v > 2147483520.0f) ? 2147483520.0f : v;
+
+        return static_cast<std::int32_t>(v + ((v >= 0.0f) ? 0.5f : -0.5f));
+    }
+    else if constexpr (std::is_same<SampleT, std::uint8_t>::value)
+    {
+        return static_cast<std::int32_t>(static_cast<std::uint32_t>(s ^ 0x80) << 24);
+    }
+    else
+    {
+        return static_cast<std::int32_t>(static_cast<std::uint32_t>(s) << (32 - 8 * sizeof(SampleT)));
+    }
+}
+
+// Round a left-aligned value to nearest at Bits instead of truncating, saturating at full scale.
+template <unsigned Bits>
+inline std::int32_t round_to(std::int32_t v) noexcept
+{
+    if constexpr (Bits == 32)
+    {
+        return v;
+    }
+    else
+    {
+        constexpr std::int32_t half = std::int32_t(1) << (31 - Bits);
+
+        return (v > INT32_MAX - half) ? INT32_MAX : v + half;
+    }
+}
+
+// Conversion kernels: Bits, Channels and SampleT are fixed at compile time. With a known
+// channel count the per-frame loop has a constant trip count and unrolls; 'count' is
+// always whole frames.
+template <unsigned Bits, std::size_t Channels, typename SampleT>
+inline void decode(const unsigned char *src, SampleT *dst, std::size_t count) noexcept
+{
+    if constexpr (Channels != dynamic_channels)
+    {
+        for (std::size_t f = 0; f < count; f += Channels, src += Channels * (Bits / 8), dst += Channels)
+            for (std::size_t c = 0; c < Channels; c++)
+                dst[c] = from_aligned<SampleT>(load<Bits>(src + c * (Bits / 8)));
+    }
+    else
+    {
+        for (std::size_t i = 0; i < count; i++)
+            dst[i] = from_aligned<SampleT>(load<Bits>(src + i * (Bits / 8)));
+    }
+}
+
+template <unsigned Bits, std::size_t Channels, typename SampleT>
+inline void encode(const SampleT *src, unsigned char *dst, std::size_t count) noexcept
+{
+    if constexpr (Channels != dynamic_channels)
+    {
+        for (std::size_t f = 0; f < count; f += Channels, src += Channels, dst += Channels * (Bits / 8))
+            for (std::size_t c = 0; c < Channels; c++)
+                store<Bits>(dst + c * (Bits / 8), round_to<Bits>(to_aligned<SampleT>(src[c])));
+    }
+    else
+    {
+        for (std::size_t i = 0; i < count; i++)
+            store<Bits>(dst + i * (Bits / 8), round_to<Bits>(to_aligned<SampleT>(src[i])));
+    }
+}
+
+// One dispatch per block on the runtime bit depth; the loops stay specialized.
+template <std::size_t Channels, typename SampleT>
+inline bool decode(unsigned bits, const unsigned char *src, SampleT *dst, std::size_t count) noexcept
+{
+    switch (bits)
+    {
+    case 8:  decode<8, Channels>(src, dst, count);  return true;
+    case 16: decode<16, Channels>(src, dst, count); return true;
+    case 24: decode<24, Channels>(src, dst, count); return true;
+    case 32: decode<32, Channels>(src, dst, count); return true;
+    default: return false;
+    }
+}
+
+template <std::size_t Channels, typename SampleT>
+inline bool encode(unsigned bits, const SampleT *src, unsigned char *dst, std::size_t count) noexcept
+{
+    switch (bits)
+    {
+    case 8:  encode<8, Channels>(src, dst, count);  return true;
+    case 16: encode<16, Channels>(src, dst, count); return true;
+    case 24: encode<24, Channels>(src, dst, count); return true;
+    case 32: encode<32, Channels>(src, dst, count); return true;
+    default: return false;
+    }
+}
+
+template <typename SampleT>
+inline bool is_native(unsigned bits) noexcept
+{
+    return (bits == 8 && native<SampleT, 8>) || (bits == 16 && native<SampleT, 16>) ||
+           (bits == 32 && native<SampleT, 32>);
+}
+
+} // namespace detail
+
+// RAII owner of a WAV handle.
+class file
+{
+public:
+    file() noexcept = default;
+
+    file(const char *name, int flags, WAV_ATTR &attr) noexcept
+        : wav_(miniwave_open(name, flags, &attr)) {}
+
+    explicit file(WAV wav) noexcept : wav_(wav) {}
+
+    ~file() { close(); }
+
+    file(const file &) = delete;
+    file &operator=(const file &) = delete;
+
+    file(file &&other) noexcept : wav_(std::exchange(other.wav_, nullptr)) {}
+
+    file &operator=(file &&other) noexcept
+    {
+        if (this != &other)
+        {
+            close();
+            wav_ = std::exchange(other.wav_, nullptr);
+        }
+        return *this;
+    }
+
+    explicit operator bool() const noexcept { return wav_ != nullptr; }
+
+    WAV get() const noexcept { return wav_; }
+
+    WAV release() noexcept { return std::exchange(wav_, nullptr); }
+
+    int close() noexcept
+    {
+        WAV wav = std::exchange(wav_, nullptr);
+        return wav ? miniwave_close(wav) : 0;
+    }
+
+    int attr(WAV_ATTR &attr) const noexcept { return miniwave_attr(wav_, &attr); }
+
+    int seek(unsigned int frame) noexcept { return miniwave_seek(wav_, frame); }
+
+    int readahead(unsigned int depth = 0, unsigned int size = 0) noexcept
+    {
+        return miniwave_readahead(wav_, depth, size);
+    }
+
+    int read(void *buf, int len) noexcept { return miniwave_read(wav_, buf, len); }
+
+    int write(const void *buf, int len) noexcept
+    {
+        return miniwave_write(wav_, const_cast<void *>(buf), len);
+    }
+
+private:
+    WAV wav_ = nullptr;
+};
+
+// Typed block reader. read() returns interleaved samples of up to 'frames' frames;
+// when the file already stores SampleT it reads straight into the returned block.
+template <typename SampleT, std::size_t Channels = dynamic_channels>
+class reader
+{
+    static_assert(std::is_same<SampleT, std::uint8_t>::value || std::is_same<SampleT, std::int16_t>::value ||
+                  std::is_same<SampleT, std::int32_t>::value || std::is_same<SampleT, float>::value,
+                  "SampleT must be uint8_t, int16_t, int32_t or float");
+
+public:
+    explicit reader(const char *name, std::size_t frames = 4096, int flags = 0)
+        : file_(name, WAVE_O_RDONLY | flags, attr_)
+    {
+        if (!file_)
+        {
+            error_ = -ENOENT;
+            return;
+        }
+
+        if ((Channels != dynamic_channels && attr_.channels != Channels) ||
+            attr_.channels == 0 || frames == 0)
+        {
+            error_ = -EINVAL;
+            file_.close();
+            return;
+        }
+
+        frames_ = frames;
+        native_ = detail::is_native<SampleT>(attr_.sampbits);
+        samples_.resize(frames_ * channels());
+        if (!native_)
+            raw_.resize(frames_ * channels() * (attr_.sampbits / 8));
+    }
+
+    explicit operator bool() const noexcept { return static_cast<bool>(file_); }
+
+    constexpr std::size_t channels() const noexcept
+    {
+        return (Channels != dynamic_channels) ? Channels : attr_.channels;
+    }
+
+    unsigned int samprate() const noexcept { return attr_.samprate; }
+    unsigned int sampbits() const noexcept { return attr_.sampbits; }
+    unsigned int frames() const noexcept { return attr_.datasize / (channels() * (attr_.sampbits / 8)); }
+    int error() const noexcept { return error_; }
+    file &handle() noexcept { return file_; }
+
+    // Next block, empty at end of data or on error (see error()).
+    span<const SampleT> read() noexcept
+    {
+        std::size_t frame = channels() * (attr_.sampbits / 8);
+        int len = 0;
+
+        if (!file_)
+            return {};
+
+        if (native_)
+            len = file_.read(samples_.data(), static_cast<int>(frames_ * frame));
+        else
+            len = file_.read(raw_.data(), static_cast<int>(frames_ * frame));
+
+        if (len <= 0)
+        {
+            error_ = len;
+            return {};
+        }
+
+        std::size_t count = static_cast<std::size_t>(len) / frame * channels();
+
+        if (!native_ && !detail::decode<Channels>(attr_.sampbits, raw_.data(), samples_.data(), count))
+        {
+            error_ = -EINVAL;
+            return {};
+        }
+
+        return span<const SampleT>(samples_.data(), count);
+    }
+
+    int seek(unsigned int frame) noexcept { return file_.seek(frame); }
+
+private:
+    WAV_ATTR attr_ = {};
+    file file_;
+    std::size_t frames_ = 0;
+    bool native_ = false;
+    int error_ = 0;
+    std::vector<SampleT> samples_;
+    std::vector<unsigned char> raw_;
+};
+
+// Typed writer; samples are converted to 'sampbits' PCM unless they already match.
+template <typename SampleT, std::size_t Channels = dynamic_channels>
+class writer
+{
+    static_assert(std::is_same<SampleT, std::uint8_t>::value || std::is_same<SampleT, std::int16_t>::value ||
+                  std::is_same<SampleT, std::int32_t>::value || std::is_same<SampleT, float>::value,
+                  "SampleT must be uint8_t, int16_t, int32_t or float");
+
+public:
+    writer(const char *name, unsigned int samprate, unsigned int channels = Channels,
+           unsigned int sampbits = detail::sample_traits<SampleT>::bits, int flags = 0)
+    {
+        if ((Channels != dynamic_channels && channels != Channels) || channels == 0 ||
+            (sampbits != 8 && sampbits != 16 && sampbits != 24 && sampbits != 32))
+        {
+            error_ = -EINVAL;
+            return;
+        }
+
+        attr_.samprate = samprate;
+        attr_.channels = channels;
+        attr_.sampbits = sampbits;
+
+        file_ = file(name, WAVE_O_WRONLY | flags, attr_);
+        if (!file_)
+            error_ = -EIO;
+
+        native_ = detail::is_native<SampleT>(sampbits);
+    }
+
+    explicit operator bool() const noexcept { return static_cast<bool>(file_); }
+
+    constexpr std::size_t channels() const noexcept
+    {
+        return (Channels != dynamic_channels) ? Channels : attr_.channels;
+    }
+
+    int error() const noexcept { return error_; }
+    file &handle() noexcept { return file_; }
+
+    // Writes whole frames from interleaved samples, returns samples written or -errno.
+    int write(span<const SampleT> samples)
+    {
+        std::size_t count = samples.size() / channels() * channels();
+        int len = 0;
+
+        if (!file_)
+            return -EBADF;
+
+        if (count == 0)
+            return 0;
+
+        if (native_)
+        {
+            len = file_.write(samples.data(), static_cast<int>(count * sizeof(SampleT)));
+            return (len < 0) ? len : static_cast<int>(len / sizeof(SampleT));
+        }
+
+        raw_.resize(count * (attr_.sampbits / 8));
+        detail::encode<Channels>(attr_.sampbits, samples.data(), raw_.data(), count);
+
+        len = file_.write(raw_.data(), static_cast<int>(raw_.size()));
+
+        return (len < 0) ? len : static_cast<int>(len / (attr_.sampbits / 8));
+    }
+
+    int close() noexcept { return file_.close(); }
+
+private:
+    WAV_ATTR attr_ = {};
+    file file_;
+    bool native_ = false;
+    int error_ = 0;
+    std::vector<unsigned char> raw_;
+};
+
+} // namespace miniwave
+
+#endif
@@ -0,0 +1,542 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miniwave.h"
+#include "miniwave_private.h"
+
+/************************************************************************************************************************/
+
+static const int adpcm_index_table[16] =
+{
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8,
+};
+
+static const int adpcm_step_table[89] =
+{
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767,
+};
+
+/*
+ * 按(步长索引, 4bit码字)预先展开的差值和下一个步长索引,
+ * 编解码每个采样只需两次查表和一次限幅.
+ */
+static short adpcm_diff[89 * 16];
+static unsigned char adpcm_next[89 * 16];
+static pthread_once_t adpcm_once = PTHREAD_ONCE_INIT;
+
+static void adpcm_table_init(void)
+{
+	int index = 0;
+	int nibble = 0;
+
+	for (index = 0; index < 89; index++)
+	{
+		for (nibble = 0; nibble < 16; nibble++)
+		{
+			int step = adpcm_step_table[index];
+			int diff = step >> 3;
+			int next = index + adpcm_index_table[nibble];
+
+			if (nibble & 4)
+				diff += step;
+			if (nibble & 2)
+				diff += step >> 1;
+			if (nibble & 1)
+				diff += step >> 2;
+			if (nibble & 8)
+				diff = -diff;
+
+			if (next < 0)
+				next = 0;
+			if (next > 88)
+				next = 88;
+
+			adpcm_diff[index * 16 + nibble] = diff;
+			adpcm_next[index * 16 + nibble] = next;
+		}
+	}
+}
+
+static inline int adpcm_clamp(int sample)
+{
+	if (sample > 32767)
+		return 32767;
+	if (sample < -32768)
+		return -32768;
+	return sample;
+}
+
+static inline unsigned int adpcm_encode_sample(int sample, int *predictor, int *index)
+{
+	int diff = sample - *predictor;
+	int step = adpcm_step_table[*index];
+	unsigned int nibble = 0;
+
+	if (diff < 0)
+	{
+		nibble = 8;
+		diff = -diff;
+	}
+
+	if (diff >= step)
+	{
+		nibble |= 4;
+		diff -= step;
+	}
+	step >>= 1;
+	if (diff >= step)
+	{
+		nibble |= 2;
+		diff -= step;
+	}
+	step >>= 1;
+	if (diff >= step)
+		nibble |= 1;
+
+	/* 编码端按解码端同样的方式重建, 保证两端预测值一致 */
+	*predictor = adpcm_clamp(*predictor + adpcm_diff[*index * 16 + nibble]);
+	*index = adpcm_next[*index * 16 + nibble];
+
+	return nibble;
+}
+
+/*
+ * 块内各通道各自从块头的预测值/步长索引开始, 数据按每通道4字节(8个采样)交织.
+ * 解码时所有通道同步推进, 各通道互不依赖的递推链可以在流水线里并行执行.
+ */
+static unsigned int adpcm_block_decode(const unsigned char *block, unsigned int size,
+				short *pcm, unsigned int channels)
+{
+	int predictor[WAVE_ADPCM_CHANNELS];
+	int index[WAVE_ADPCM_CHANNELS];
+	unsigned int groups = 0;
+	unsigned int g = 0;
+	unsigned int k = 0;
+	unsigned int c = 0;
+
+	if (size < 4 * channels)
+		return 0;
+
+	for (c = 0; c < channels; c++)
+	{
+		predictor[c] = (short)(block[4 * c] | (block[4 * c + 1] << 8));
+		index[c] = block[4 * c + 2];
+		if (index[c] > 88)
+			index[c] = 88;
+
+		pcm[c] = predictor[c];
+	}
+
+	groups = (size - 4 * channels) / (4 * channels);
+	block += 4 * channels;
+	pcm += channels;
+
+	for (g = 0; g < groups; g++)
+	{
+		for (k = 0; k < 4; k++)
+		{
+			for (c = 0; c < channels; c++)
+			{
+				unsigned int byte = block[4 * c + k];
+				unsigned int lo = byte & 0x0F;
+				unsigned int hi = byte >> 4;
+				int p = predictor[c];
+				int i = index[c];
+
+				p = adpcm_clamp(p + adpcm_diff[i * 16 + lo]);
+				i = adpcm_next[i * 16 + lo];
+				pcm[(2 * k) * channels + c] = p;
+
+				p = adpcm_clamp(p + adpcm_diff[i * 16 + hi]);
+				i = adpcm_next[i * 16 + hi];
+				pcm[(2 * k + 1) * channels + c] = p;
+
+				predictor[c] = p;
+				index[c] = i;
+			}
+		}
+
+		block += 4 * channels;
+		pcm += 8 * channels;
+	}
+
+	return 1 + groups * 8;
+}
+
+static void adpcm_block_encode(struct WAVE_ADPCM *adpcm)
+{
+	unsigned int channels = adpcm->channels;
+	unsigned int groups = (adpcm->samplesPerBlock - 1) / 8;
+	unsigned char *block = adpcm->block;
+	const short *pcm = adpcm->pcm;
+	int predictor = 0;
+	unsigned int g = 0;
+	unsigned int k = 0;
+	unsigned int c = 0;
+
+	for (c = 0; c < channels; c++)
+	{
+		block[4 * c]     = pcm[c] & 0xFF;
+		block[4 * c + 1] = (pcm[c] >> 8) & 0xFF;
+		block[4 * c + 2] = adpcm->index[c];
+		block[4 * c + 3] = 0;
+	}
+
+	for (c = 0; c < channels; c++)
+	{
+		const short *src = pcm + channels + c;
+		unsigned char *dst = block + 4 * channels + 4 * c;
+
+		predictor = pcm[c];
+
+		for (g = 0; g < groups; g++)
+		{
+			for (k = 0; k < 4; k++)
+			{
+				unsigned int lo = adpcm_encode_sample(src[(2 * k) * channels],
+							&predictor, &(adpcm->index[c]));
+				unsigned int hi = adpcm_encode_sample(src[(2 * k + 1) * channels],
+							&predictor, &(adpcm->index[c]));
+
+				dst[k] = lo | (hi << 4);
+			}
+
+			src += 8 * channels;
+			dst += 4 * channels;
+		}
+	}
+}
+
+/************************************************************************************************************************/
+
+/* 读入并解码下一块, 返回块内有效帧数 */
+static int wave_adpcm_fill(struct WAVE *wave)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+	int length = 0;
+	int retval = 0;
+
+	adpcm->count = 0;
+	adpcm->used = 0;
+
+	if (adpcm->frames >= adpcm->sampleLength)
+		return 0;
+
+	for (length = 0; length < adpcm->blockAlign; length += retval)
+	{
+		retval = wave_data_read(wave, adpcm->block + length, adpcm->blockAlign - length);
+		if (retval <= 0)
+			break;
+	}
+
+	if ((retval < 0) && (length == 0))
+		return retval;
+
+	adpcm->count = adpcm_block_decode(adpcm->block, length, adpcm->pcm, adpcm->channels);
+
+	if (adpcm->count > adpcm->sampleLength - adpcm->frames)
+		adpcm->count = adpcm->sampleLength - adpcm->frames;
+
+	return adpcm->count;
+}
+
+static int wave_adpcm_read(struct WAVE *wave, void *buf, int len)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+	unsigned int channels = adpcm->channels;
+	unsigned int frames = len / (channels * sizeof(short));
+	unsigned int count = 0;
+	short *pcm = (short *)buf;
+	int retval = 0;
+
+	while (frames > 0)
+	{
+		if (adpcm->used == adpcm->count)
+		{
+			retval = wave_adpcm_fill(wave);
+			if ((retval < 0) && (pcm == (short *)buf))
+				return retval;
+			if (retval <= 0)
+				break;
+		}
+
+		count = adpcm->count - adpcm->used;
+		if (count > frames)
+			count = frames;
+
+		memcpy(pcm, adpcm->pcm + adpcm->used * channels, count * channels * sizeof(short));
+
+		adpcm->used += count;
+		adpcm->frames += count;
+		pcm += count * channels;
+		frames -= count;
+	}
+
+	return (int)((char *)pcm - (char *)buf);
+}
+
+static int wave_adpcm_block(struct WAVE *wave)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+	int retval = 0;
+
+	adpcm_block_encode(adpcm);
+
+	retval = wave_data_write(wave, adpcm->block, adpcm->blockAlign);
+	if (retval < 0)
+		return retval;
+
+	adpcm->frames += adpcm->used;
+	adpcm->used = 0;
+
+	return 0;
+}
+
+static int wave_adpcm_write(struct WAVE *wave, const void *buf, int len)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+	unsigned int channels = adpcm->channels;
+	unsigned int frames = len / (channels * sizeof(short));
+	unsigned int count = 0;
+	const short *pcm = (const short *)buf;
+	int retval = 0;
+
+	while (frames > 0)
+	{
+		count = adpcm->samplesPerBlock - adpcm->used;
+		if (count > frames)
+			count = frames;
+
+		memcpy(adpcm->pcm + adpcm->used * channels, pcm, count * channels * sizeof(short));
+
+		adpcm->used += count;
+		pcm += count * channels;
+		frames -= count;
+
+		if (adpcm->used == adpcm->samplesPerBlock)
+		{
+			retval = wave_adpcm_block(wave);
+			if (retval < 0)
+				break;
+		}
+	}
+
+	/* 只收整帧, 返回实际收下的字节数; 写盘失败的块留在缓冲区下次重试 */
+	if ((retval < 0) && (pcm == (const short *)buf))
+		return retval;
+
+	return (int)((const char *)pcm - (const char *)buf);
+}
+
+static int wave_adpcm_flush(struct WAVE *wave)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+	unsigned int channels = adpcm->channels;
+	unsigned int i = 0;
+	unsigned int used = adpcm->used;
+
+	if (used == 0)
+		return 0;
+
+	/* 最后一块用末帧补满, fact记录真实帧数 */
+	for (i = used; i < adpcm->samplesPerBlock; i++)
+		memcpy(adpcm->pcm + i * channels, adpcm->pcm + (used - 1) * channels,
+			channels * sizeof(short));
+
+	return wave_adpcm_block(wave);
+}
+
+static int wave_adpcm_seek(struct WAVE *wave, unsigned int frame)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+	unsigned int block = 0;
+	int retval = 0;
+
+	if (frame > adpcm->sampleLength)
+		frame = adpcm->sampleLength;
+
+	/* 块之间互不依赖, 定位到所在块再丢弃块内前面的帧 */
+	block = frame / adpcm->samplesPerBlock;
+
+	retval = wave_data_seek(wave, wave->dataOffset + (off_t)block * adpcm->blockAlign);
+	if (retval < 0)
+		return retval;
+
+	adpcm->frames = block * adpcm->samplesPerBlock;
+	adpcm->count = 0;
+	adpcm->used = 0;
+
+	if (frame > adpcm->frames)
+	{
+		retval = wave_adpcm_fill(wave);
+		if (retval < 0)
+			return retval;
+
+		adpcm->used = frame - adpcm->frames;
+		if (adpcm->used > adpcm->count)
+			adpcm->used = adpcm->count;
+
+		adpcm->frames += adpcm->used;
+	}
+
+	return 0;
+}
+
+static unsigned int wave_adpcm_pack(struct WAVE *wave, void **image)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+
+	*image = &(adpcm->header);
+
+	return wave_header_pack_ext(wave, &(adpcm->header), adpcm->samplesPerBlock, adpcm->frames);
+}
+
+static void wave_adpcm_attr(struct WAVE *wave, WAV_ATTR *attr)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+	unsigned int frames = adpcm->frames;
+
+	/* 对调用者收发的都是PCM16 */
+	if (wave->flags & WAVE_O_WRONLY)
+		frames += adpcm->used;
+
+	attr->sampbits = 16;
+	attr->dataoffs = frames * adpcm->channels * sizeof(short);
+	attr->datasize = ((wave->flags & WAVE_O_WRONLY) ? frames : adpcm->sampleLength) * \
+			adpcm->channels * sizeof(short);
+}
+
+static void wave_adpcm_close(struct WAVE *wave)
+{
+	struct WAVE_ADPCM *adpcm = wave->adpcm;
+
+	if (adpcm == NULL)
+		return;
+
+	free(adpcm->block);
+	free(adpcm->pcm);
+	free(adpcm);
+
+	wave->adpcm = NULL;
+	wave->codec = NULL;
+}
+
+static const struct WAVE_CODEC wave_adpcm_codec =
+{
+	.read  = wave_adpcm_read,
+	.write = wave_adpcm_write,
+	.flush = wave_adpcm_flush,
+	.seek  = wave_adpcm_seek,
+	.pack  = wave_adpcm_pack,
+	.attr  = wave_adpcm_attr,
+	.close = wave_adpcm_close,
+};
+
+int wave_adpcm_open(struct WAVE *wave, WAV_ATTR *attr, struct WAVE_EXTRA *extra)
+{
+	struct FMTS_CHUNK *fmts = &(wave->header.fmts);
+	struct WAVE_ADPCM *adpcm = NULL;
+	unsigned int channels = fmts->numChannels;
+	unsigned int blockAlign = 0;
+	unsigned int samplesPerBlock = 0;
+	unsigned int dataSize = wave->header.data.dataSize;
+	unsigned int frames = 0;
+	unsigned int remain = 0;
+
+	pthread_once(&adpcm_once, adpcm_table_init);
+
+	if ((channels == 0) || (channels > WAVE_ADPCM_CHANNELS) || (fmts->sampleRate == 0))
+	{
+		WAV_ERR("Invalid channels[%u] sampleRate[%u]", channels, fmts->sampleRate);
+		return -EINVAL;
+	}
+
+	if (attr)
+	{
+		if (attr->sampbits != 16)
+		{
+			WAV_ERR("ADPCM encoder expects 16bit input, sampbits[%u]", attr->sampbits);
+			return -EINVAL;
+		}
+
+		/* 与常见编码器一致: 每通道256字节, 采样率每超过11025翻倍 */
+		blockAlign = 256 * channels * ((fmts->sampleRate > 11025) ? (fmts->sampleRate / 11025) : 1);
+		samplesPerBlock = (blockAlign / channels - 4) * 2 + 1;
+
+		fmts->formatSize = FMTS_CHUNK_SIZE - 8 + 4;
+		fmts->compressionCode = WAVE_FORMAT_IMA_ADPCM;
+		fmts->blockAlign = blockAlign;
+		fmts->bitsPerSample = 4;
+		fmts->bytesPerSecond = (unsigned long long)fmts->sampleRate * blockAlign / samplesPerBlock;
+	}
+	else
+	{
+		blockAlign = fmts->blockAlign;
+
+		if ((fmts->bitsPerSample != 4) || (blockAlign <= 4 * channels) || (blockAlign % (4 * channels)))
+		{
+			WAV_ERR("Invalid bitsPerSample[%u] blockAlign[%u] channels[%u]",
+				fmts->bitsPerSample, blockAlign, channels);
+			return -EINVAL;
+		}
+
+		samplesPerBlock = (blockAlign / channels - 4) * 2 + 1;
+		if (extra->samplesPerBlock && (extra->samplesPerBlock < samplesPerBlock))
+			samplesPerBlock = extra->samplesPerBlock;
+
+		frames = dataSize / blockAlign * samplesPerBlock;
+		remain = dataSize % blockAlign;
+		if (remain >= 4 * channels)
+			frames += 1 + (remain - 4 * channels) / (4 * channels) * 8;
+
+		if (extra->hasFact && (extra->sampleLength < frames))
+			frames = extra->sampleLength;
+	}
+
+	adpcm = (struct WAVE_ADPCM *)calloc(1, sizeof(struct WAVE_ADPCM));
+	if (adpcm == NULL)
+	{
+		WAV_ERR("calloc(%lu) fail", sizeof(struct WAVE_ADPCM));
+		return -ENOMEM;
+	}
+
+	adpcm->channels = channels;
+	adpcm->blockAlign = blockAlign;
+	adpcm->samplesPerBlock = samplesPerBlock;
+	adpcm->sampleLength = frames;
+
+	/* 解码时一块可能比samplesPerBlock多出几个采样, 按块长算上限 */
+	adpcm->block = (unsigned char *)malloc(blockAlign);
+	adpcm->pcm = (short *)malloc(((blockAlign / channels - 4) * 2 + 1) * channels * sizeof(short));
+	if ((adpcm->block == NULL) || (adpcm->pcm == NULL))
+	{
+		WAV_ERR("malloc(%u) fail", blockAlign);
+		free(adpcm->block);
+		free(adpcm->pcm);
+		free(adpcm);
+		return -ENOMEM;
+	}
+
+	wave->adpcm = adpcm;
+	wave->codec = &wave_adpcm_codec;
+
+	return 0;
+}
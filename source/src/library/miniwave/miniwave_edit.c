@@ -0,0 +1,572 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/sendfile.h>
+
+#include "miniwave.h"
+#include "miniwave_private.h"
+
+/************************************************************************************************************************/
+
+#define WAVE_COPY_BUFSIZE	(256 * 1024)
+#define WAVE_COPY_ALIGN		(64 * 1024)	// 块大小超过这个值时不再填充JUNK块对齐
+#define JUNK_TYPE			"JUNK"
+
+/*
+ * 数据搬运优先走copy_file_range(), 跨文件系统等不支持的情况退化为sendfile(),
+ * 最后才经过用户态缓冲区. 只有源和目标偏移都按文件系统块对齐时内核才会共享区段(reflink),
+ * 否则copy_file_range()也是在内核里整段拷贝; 输出头部用JUNK块把data偏移对齐到第一段源数据.
+ */
+static int wave_copy_buffered(int ofile, off_t ooffset, int ifile, off_t ioffset, size_t size)
+{
+	char *buffer = NULL;
+	ssize_t length = 0;
+	int retval = 0;
+
+	buffer = (char *)malloc(WAVE_COPY_BUFSIZE);
+	if (buffer == NULL)
+	{
+		WAV_ERR("malloc(%d) fail", WAVE_COPY_BUFSIZE);
+		return -ENOMEM;
+	}
+
+	while (size > 0)
+	{
+		length = (size > WAVE_COPY_BUFSIZE) ? WAVE_COPY_BUFSIZE : size;
+
+		length = pread(ifile, buffer, length, ioffset);
+		if (length <= 0)
+		{
+			WAV_ERR("pread(%d, %ld) fail[%d]", ifile, (long)ioffset, errno);
+			retval = (length < 0) ? -errno : -EIO;
+			break;
+		}
+
+		length = pwrite(ofile, buffer, length, ooffset);
+		if (length <= 0)
+		{
+			WAV_ERR("pwrite(%d, %ld) fail[%d]", ofile, (long)ooffset, errno);
+			retval = (length < 0) ? -errno : -EIO;
+			break;
+		}
+
+		ioffset += length;
+		ooffset += length;
+		size -= length;
+	}
+
+	free(buffer);
+
+	return retval;
+}
+
+static int wave_copy_sendfile(int ofile, off_t ooffset, int ifile, off_t ioffset, size_t size)
+{
+	ssize_t length = 0;
+
+	if (lseek(ofile, ooffset, SEEK_SET) < 0)
+	{
+		WAV_ERR("lseek(%d, %ld, SEEK_SET) fail[%d]", ofile, (long)ooffset, errno);
+		return -errno;
+	}
+
+	while (size > 0)
+	{
+		length = sendfile(ofile, ifile, &ioffset, size);
+		if (length < 0)
+		{
+			if ((errno == EINVAL) || (errno == ENOSYS))
+				return wave_copy_buffered(ofile, ooffset, ifile, ioffset, size);
+
+			WAV_ERR("sendfile(%d, %d, %ld, %lu) fail[%d]",
+				ofile, ifile, (long)ioffset, (unsigned long)size, errno);
+			return -errno;
+		}
+		else if (length == 0)
+		{
+			WAV_ERR("sendfile(%d, %d, %ld) unexpected eof", ofile, ifile, (long)ioffset);
+			return -EIO;
+		}
+
+		ooffset += length;
+		size -= length;
+	}
+
+	return 0;
+}
+
+static int wave_copy_range(int ofile, off_t ooffset, int ifile, off_t ioffset, size_t size)
+{
+	struct stat st;
+	ssize_t length = 0;
+	size_t head = 0;
+
+	/* 偏移同余但不在块边界时, 先单独搬到块边界, 后面整块的部分才能共享区段 */
+	if ((fstat(ofile, &st) == 0) && (st.st_blksize > 0) && (st.st_blksize <= WAVE_COPY_ALIGN) &&
+		(ioffset % st.st_blksize == ooffset % st.st_blksize) && (ioffset % st.st_blksize))
+	{
+		head = st.st_blksize - ioffset % st.st_blksize;
+		if (head > size)
+			head = size;
+	}
+
+	while (size > 0)
+	{
+		length = copy_file_range(ifile, &ioffset, ofile, &ooffset, head ? head : size, 0);
+		if (length < 0)
+		{
+			if ((errno == EXDEV) || (errno == ENOSYS) || (errno == EINVAL) ||
+				(errno == EOPNOTSUPP) || (errno == EBADF))
+				return wave_copy_sendfile(ofile, ooffset, ifile, ioffset, size);
+
+			WAV_ERR("copy_file_range(%d, %ld, %d, %ld, %lu) fail[%d]",
+				ifile, (long)ioffset, ofile, (long)ooffset, (unsigned long)size, errno);
+			return -errno;
+		}
+		else if (length == 0)
+		{
+			WAV_ERR("copy_file_range(%d, %ld) unexpected eof", ifile, (long)ioffset);
+			return -EIO;
+		}
+
+		size -= length;
+		head -= (head > length) ? length : head;
+	}
+
+	return 0;
+}
+
+/************************************************************************************************************************/
+
+struct WAVE_SOURCE
+{
+	int file;
+	struct WAVE_HEADER header;
+	unsigned int dataOffset;
+	unsigned int frame;
+};
+
+static int wave_source_open(struct WAVE_SOURCE *src, const char *name)
+{
+	struct FMTS_CHUNK *fmts = &(src->header.fmts);
+	int retval = 0;
+
+	src->file = open(name, O_RDONLY);
+	if (src->file < 0)
+	{
+		WAV_ERR("open(%s, O_RDONLY) fail[%d]", name, errno);
+		return -errno;
+	}
+
+	retval = wave_header_read(src->file, &(src->header), NULL);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	src->dataOffset = retval;
+
+	/* 只有线性PCM可以按字节区间直接拼接 */
+	if ((fmts->compressionCode != 1) || (fmts->sampleRate == 0) ||
+		(fmts->bytesPerSecond % fmts->sampleRate))
+	{
+		WAV_ERR("Unsupported compressionCode[%u] bytesPerSecond[%u] sampleRate[%u]",
+			fmts->compressionCode, fmts->bytesPerSecond, fmts->sampleRate);
+		retval = -EPERM;
+		goto ERR_EXIT;
+	}
+
+	src->frame = fmts->bytesPerSecond / fmts->sampleRate;
+	if (src->frame == 0)
+	{
+		WAV_ERR("Invalid frame size of %s", name);
+		retval = -EPERM;
+		goto ERR_EXIT;
+	}
+
+	return 0;
+
+ERR_EXIT:
+	close(src->file);
+	src->file = -1;
+
+	return retval;
+}
+
+/*
+ * 输出的data偏移按source(第一段源数据的偏移)对文件系统块大小取同余, 中间插入JUNK块填充,
+ * 第一段可以共享区段; 拼接时后面的段只有恰好同余才能共享.
+ */
+static int wave_target_open(const char *name, struct WAVE_HEADER *header, unsigned int datasize,
+				off_t source, unsigned int *offset, const struct stat *except, int count)
+{
+	struct stat st;
+	unsigned int base = RIFF_CHUNK_SIZE + FMTS_CHUNK_SIZE + DATA_CHUNK_SIZE;
+	unsigned int align = 0;
+	long long pad = 0;
+	int file = 0;
+	int i = 0;
+
+	/* 输出不能覆盖任何一个输入, O_TRUNC会先把输入清空 */
+	if (stat(name, &st) == 0)
+	{
+		for (i = 0; i < count; i++)
+		{
+			if ((st.st_dev == except[i].st_dev) && (st.st_ino == except[i].st_ino))
+			{
+				WAV_ERR("Output %s overlaps input", name);
+				return -EINVAL;
+			}
+		}
+	}
+
+	file = open(name, O_CREAT | O_TRUNC | O_WRONLY, 0755);
+	if (file < 0)
+	{
+		WAV_ERR("open(%s, O_CREAT | O_TRUNC | O_WRONLY) fail[%d]", name, errno);
+		return -errno;
+	}
+
+	*offset = base;
+
+	if (fstat(file, &st) == 0)
+		align = st.st_blksize;
+
+	/* JUNK块长度必须是偶数, 源偏移为奇数时无法对齐 */
+	if ((align > 0) && (align <= WAVE_COPY_ALIGN) && !(source & 1) && (source % align != base % align))
+	{
+		pad = ((long long)source - base - DATA_CHUNK_SIZE) % align;
+		*offset = base + DATA_CHUNK_SIZE + (unsigned int)((pad < 0) ? pad + align : pad);
+	}
+
+	/* 头部在数据全部搬运完后由wave_target_close()写入 */
+	header->fmts.formatSize = FMTS_CHUNK_SIZE - 8;
+	memcpy(header->data.dataType, DATA_TYPE, DATA_TYPE_SIZE);
+	header->data.dataSize = datasize;
+	header->riff.riffSize = *offset - 8 + datasize;
+
+	return file;
+}
+
+static int wave_target_close(int file, const char *name, const struct WAVE_HEADER *header,
+				unsigned int offset, int retval)
+{
+	struct DATA_CHUNK junk;
+	unsigned int base = RIFF_CHUNK_SIZE + FMTS_CHUNK_SIZE;
+	unsigned char *image = NULL;
+	int result = 0;
+
+	if (retval >= 0)
+	{
+		image = (unsigned char *)calloc(1, offset);
+		if (image == NULL)
+		{
+			WAV_ERR("calloc(%u) fail", offset);
+			retval = -ENOMEM;
+		}
+	}
+
+	if (retval >= 0)
+	{
+		/* RIFF+fmt, 对齐用的JUNK块, 最后是data块头 */
+		memcpy(image, header, base);
+		if (offset > base + DATA_CHUNK_SIZE)
+		{
+			memcpy(junk.dataType, JUNK_TYPE, 4);
+			junk.dataSize = offset - base - 2 * DATA_CHUNK_SIZE;
+			memcpy(image + base, &junk, DATA_CHUNK_SIZE);
+		}
+		memcpy(image + offset - DATA_CHUNK_SIZE, &(header->data), DATA_CHUNK_SIZE);
+
+		result = wave_header_write(file, image, offset);
+		if (result < 0)
+			retval = result;
+
+		free(image);
+	}
+
+	close(file);
+
+	/* 中途失败不留下头部声明了完整长度的残缺文件 */
+	if ((retval < 0) && (unlink(name) < 0))
+		WAV_WRN("unlink(%s) fail[%d]", name, errno);
+
+	return retval;
+}
+
+static int wave_source_stat(struct WAVE_SOURCE *src, struct stat *st)
+{
+	if (fstat(src->file, st) < 0)
+	{
+		WAV_ERR("fstat(%d) fail[%d]", src->file, errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+int miniwave_trim(const char *iname, const char *oname, unsigned int start, unsigned int frames)
+{
+	struct WAVE_SOURCE src;
+	struct WAVE_HEADER header;
+	struct stat st;
+	unsigned int total = 0;
+	unsigned int size = 0;
+	unsigned int target = 0;
+	int file = -1;
+	int retval = 0;
+
+	if ((iname == NULL) || (oname == NULL))
+	{
+		WAV_ERR("Invalid iname[%p] oname[%p]", iname, oname);
+		return -EINVAL;
+	}
+
+	retval = wave_source_open(&src, iname);
+	if (retval < 0)
+		return retval;
+
+	total = src.header.data.dataSize / src.frame;
+	if (start > total)
+		start = total;
+	if (frames > total - start)
+		frames = total - start;
+
+	size = frames * src.frame;
+
+	retval = wave_source_stat(&src, &st);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	memcpy(&header, &(src.header), sizeof(struct WAVE_HEADER));
+
+	file = wave_target_open(oname, &header, size, src.dataOffset + (off_t)start * src.frame,
+				&target, &st, 1);
+	if (file < 0)
+	{
+		retval = file;
+		goto ERR_EXIT;
+	}
+
+	retval = wave_copy_range(file, target, src.file,
+				src.dataOffset + (off_t)start * src.frame, size);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	retval = frames;
+
+ERR_EXIT:
+	if (file >= 0)
+		retval = wave_target_close(file, oname, &header, target, retval);
+
+	close(src.file);
+
+	return retval;
+}
+
+int miniwave_concat(const char *oname, const char **inames, int count)
+{
+	struct WAVE_SOURCE *src = NULL;
+	struct WAVE_HEADER header;
+	struct FMTS_CHUNK *fmts = NULL;
+	struct stat *st = NULL;
+	unsigned long long total = 0;
+	off_t offset = 0;
+	unsigned int target = 0;
+	int file = -1;
+	int opened = 0;
+	int i = 0;
+	int retval = 0;
+
+	if ((oname == NULL) || (inames == NULL) || (count <= 0))
+	{
+		WAV_ERR("Invalid oname[%p] inames[%p] count[%d]", oname, inames, count);
+		return -EINVAL;
+	}
+
+	src = (struct WAVE_SOURCE *)calloc(count, sizeof(struct WAVE_SOURCE));
+	st  = (struct stat *)calloc(count, sizeof(struct stat));
+	if ((src == NULL) || (st == NULL))
+	{
+		WAV_ERR("calloc(%d) fail", count);
+		retval = -ENOMEM;
+		goto ERR_EXIT;
+	}
+
+	for (opened = 0; opened < count; opened++)
+	{
+		retval = wave_source_open(&src[opened], inames[opened]);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		retval = wave_source_stat(&src[opened], &st[opened]);
+		if (retval < 0)
+		{
+			close(src[opened].file);
+			goto ERR_EXIT;
+		}
+
+		fmts = &(src[opened].header.fmts);
+		if ((fmts->numChannels != src[0].header.fmts.numChannels) ||
+			(fmts->sampleRate != src[0].header.fmts.sampleRate) ||
+			(fmts->bytesPerSecond != src[0].header.fmts.bytesPerSecond) ||
+			(fmts->bitsPerSample != src[0].header.fmts.bitsPerSample))
+		{
+			WAV_ERR("Format of %s mismatch %s", inames[opened], inames[0]);
+			close(src[opened].file);
+			retval = -EPERM;
+			goto ERR_EXIT;
+		}
+
+		/* 末尾不完整的帧不参与拼接 */
+		total += src[opened].header.data.dataSize / src[opened].frame * src[opened].frame;
+	}
+
+	if (total > 0xFFFFFFFFULL - sizeof(struct WAVE_HEADER) - WAVE_COPY_ALIGN)
+	{
+		WAV_ERR("Total data size[%llu] overflow", total);
+		retval = -EFBIG;
+		goto ERR_EXIT;
+	}
+
+	memcpy(&header, &(src[0].header), sizeof(struct WAVE_HEADER));
+
+	file = wave_target_open(oname, &header, (unsigned int)total, src[0].dataOffset, &target, st, count);
+	if (file < 0)
+	{
+		retval = file;
+		goto ERR_EXIT;
+	}
+
+	offset = target;
+
+	for (i = 0; i < count; i++)
+	{
+		unsigned int size = src[i].header.data.dataSize / src[i].frame * src[i].frame;
+
+		retval = wave_copy_range(file, offset, src[i].file, src[i].dataOffset, size);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		offset += size;
+	}
+
+	retval = (int)(total / src[0].frame);
+
+ERR_EXIT:
+	if (file >= 0)
+		retval = wave_target_close(file, oname, &header, target, retval);
+
+	for (i = 0; i < opened; i++)
+		close(src[i].file);
+
+	if (src)
+		free(src);
+
+	if (st)
+		free(st);
+
+	return retval;
+}
+
+int miniwave_silence_trim(const char *iname, const char *oname, double threshold, unsigned int minimum)
+{
+	struct WAVE_SOURCE src;
+	struct WAVE_HEADER header;
+	struct stat st;
+	WAV_REGION *regions = NULL;
+	WAV_ATTR attr;
+	WAV wav = NULL;
+	unsigned long long total = 0;
+	off_t offset = 0;
+	unsigned int target = 0;
+	int file = -1;
+	int count = 0;
+	int i = 0;
+	int retval = 0;
+
+	if ((iname == NULL) || (oname == NULL) || isnan(threshold))
+	{
+		WAV_ERR("Invalid iname[%p] oname[%p] threshold[%f]", iname, oname, threshold);
+		return -EINVAL;
+	}
+
+	retval = wave_source_open(&src, iname);
+	if (retval < 0)
+		return retval;
+
+	wav = miniwave_open(iname, WAVE_O_RDONLY, &attr);
+	if (wav == NULL)
+	{
+		retval = -EPERM;
+		goto ERR_EXIT;
+	}
+
+	/* 有预读时读盘和扫描重叠 */
+	miniwave_readahead(wav, 0, 0);
+
+	count = wave_silence_scan(wav, threshold, minimum, &regions);
+	if (count < 0)
+	{
+		retval = count;
+		goto ERR_EXIT;
+	}
+
+	for (i = 0; i < count; i++)
+		total += regions[i].frames;
+
+	retval = wave_source_stat(&src, &st);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	memcpy(&header, &(src.header), sizeof(struct WAVE_HEADER));
+
+	file = wave_target_open(oname, &header, (unsigned int)(total * src.frame),
+				src.dataOffset + (count ? (off_t)regions[0].start * src.frame : 0), &target, &st, 1);
+	if (file < 0)
+	{
+		retval = file;
+		goto ERR_EXIT;
+	}
+
+	/* 有声区间逐段在内核里搬运, 静音部分不经过用户态 */
+	offset = target;
+
+	for (i = 0; i < count; i++)
+	{
+		size_t size = (size_t)regions[i].frames * src.frame;
+
+		retval = wave_copy_range(file, offset, src.file,
+					src.dataOffset + (off_t)regions[i].start * src.frame, size);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		offset += size;
+	}
+
+	retval = (int)total;
+
+ERR_EXIT:
+	if (file >= 0)
+		retval = wave_target_close(file, oname, &header, target, retval);
+
+	if (wav)
+		miniwave_close(wav);
+
+	free(regions);
+	close(src.file);
+
+	return retval;
+}
@@ -0,0 +1,660 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "miniwave.h"
+#include "miniwave_private.h"
+
+/************************************************************************************************************************/
+
+#define GAIN_BLOCK_SIZE		(256 * 1024)	// 每次pread/pwrite的字节数
+#define GAIN_MAX_DB			96.0
+#define GAIN_SHIFT			30				// 增益定点数的小数位上限
+
+#define LOUD_STEP_MS		100				// 门限块按100ms步进, 400ms一块(75%重叠)
+#define LOUD_BLOCK_STEPS	4
+#define LOUD_ABS_GATE		(-70.0)
+#define LOUD_REL_GATE		(-10.0)
+
+struct GAIN_SOURCE
+{
+	int file;
+	struct WAVE_HEADER header;
+	off_t dataOffset;
+	unsigned int dataSize;
+	unsigned int bytes;
+	unsigned int channels;
+	int lo;
+	int hi;
+};
+
+/* BS.1770 K计权: 高搁架 + 高通两级biquad, 按采样率用双线性变换求系数 */
+struct LOUD_BIQUAD
+{
+	double b[3];
+	double a[3];
+};
+
+struct LOUD_METER
+{
+	struct LOUD_BIQUAD shelf;
+	struct LOUD_BIQUAD pass;
+	double (*state)[4];			// 每通道两级各两个状态
+	double *weight;
+	double scale;				// 采样归一化到[-1, 1)
+	double energy;				// 当前100ms内加权平方和
+	unsigned int step;			// 每100ms的帧数
+	unsigned int count;
+	double *steps;				// 每100ms的加权平方和
+	unsigned int nsteps;
+	unsigned int capacity;
+};
+
+/************************************************************************************************************************/
+
+static int gain_source_open(struct GAIN_SOURCE *src, const char *name, int flags)
+{
+	struct FMTS_CHUNK *fmts = &(src->header.fmts);
+	struct stat st;
+	int retval = 0;
+
+	src->file = open(name, flags);
+	if (src->file < 0)
+	{
+		WAV_ERR("open(%s, %d) fail[%d]", name, flags, errno);
+		return -errno;
+	}
+
+	retval = wave_header_read(src->file, &(src->header), NULL);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	src->dataOffset = retval;
+	src->dataSize = src->header.data.dataSize;
+	src->bytes = fmts->bitsPerSample / 8;
+	src->channels = fmts->numChannels;
+
+	/* 增益只能原地改写线性PCM */
+	if ((fmts->compressionCode != WAVE_FORMAT_PCM) || (src->channels == 0) || (fmts->sampleRate == 0) ||
+		(fmts->bitsPerSample % 8) || (src->bytes == 0) || (src->bytes > 4))
+	{
+		WAV_ERR("Unsupported compressionCode[%u] numChannels[%u] sampleRate[%u] bitsPerSample[%u]",
+			fmts->compressionCode, fmts->numChannels, fmts->sampleRate, fmts->bitsPerSample);
+		retval = -EPERM;
+		goto ERR_EXIT;
+	}
+
+	/* 写入中断的文件data块可能比实际内容长 */
+	if ((fstat(src->file, &st) == 0) && (src->dataOffset + (off_t)src->dataSize > st.st_size))
+	{
+		WAV_WRN("dataSize[%u] exceed file size[%ld]", src->dataSize, (long)st.st_size);
+		src->dataSize = (st.st_size > src->dataOffset) ? st.st_size - src->dataOffset : 0;
+	}
+
+	src->dataSize -= src->dataSize % (src->bytes * src->channels);
+
+	src->hi = (int)((1U << (src->bytes * 8 - 1)) - 1);
+	src->lo = -src->hi - 1;
+
+	return 0;
+
+ERR_EXIT:
+	close(src->file);
+	src->file = -1;
+
+	return retval;
+}
+
+/*
+ * 采样统一展开成int32做运算, 8bit无符号先减去128; 加载/写回和增益循环都只处理
+ * 连续数组, 由编译器向量化, 不依赖平台intrinsics.
+ */
+static void gain_load(const unsigned char *s, int *d, unsigned int n, unsigned int bytes)
+{
+	unsigned int i = 0;
+
+	switch (bytes)
+	{
+	case 1:
+		for (i = 0; i < n; i++)
+			d[i] = (int)s[i] - 128;
+		break;
+	case 2:
+		for (i = 0; i < n; i++)
+			d[i] = (short)(s[2 * i] | (s[2 * i + 1] << 8));
+		break;
+	case 3:
+		for (i = 0; i < n; i++)
+			d[i] = (int)((s[3 * i] << 8) | (s[3 * i + 1] << 16) | ((unsigned int)s[3 * i + 2] << 24)) >> 8;
+		break;
+	case 4:
+		for (i = 0; i < n; i++)
+			d[i] = (int)(s[4 * i] | (s[4 * i + 1] << 8) | (s[4 * i + 2] << 16) | ((unsigned int)s[4 * i + 3] << 24));
+		break;
+	}
+}
+
+static void gain_store(const int *s, unsigned char *d, unsigned int n, unsigned int bytes)
+{
+	unsigned int i = 0;
+
+	switch (bytes)
+	{
+	case 1:
+		for (i = 0; i < n; i++)
+			d[i] = (unsigned char)(s[i] + 128);
+		break;
+	case 2:
+		for (i = 0; i < n; i++)
+		{
+			d[2 * i] = (unsigned char)s[i];
+			d[2 * i + 1] = (unsigned char)(s[i] >> 8);
+		}
+		break;
+	case 3:
+		for (i = 0; i < n; i++)
+		{
+			d[3 * i] = (unsigned char)s[i];
+			d[3 * i + 1] = (unsigned char)(s[i] >> 8);
+			d[3 * i + 2] = (unsigned char)(s[i] >> 16);
+		}
+		break;
+	case 4:
+		for (i = 0; i < n; i++)
+		{
+			d[4 * i] = (unsigned char)s[i];
+			d[4 * i + 1] = (unsigned char)(s[i] >> 8);
+			d[4 * i + 2] = (unsigned char)(s[i] >> 16);
+			d[4 * i + 3] = (unsigned char)(s[i] >> 24);
+		}
+		break;
+	}
+}
+
+/* 定点增益: 64bit乘积舍入后饱和到采样范围, 返回被削顶的采样数 */
+static unsigned int gain_apply(int *s, unsigned int n, long long gain, int shift, int lo, int hi)
+{
+	long long round = 1LL << (shift - 1);
+	unsigned int clipped = 0;
+	unsigned int i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		long long v = ((long long)s[i] * gain + round) >> shift;
+
+		clipped += (v < lo) | (v > hi);
+		v = (v < lo) ? lo : v;
+		v = (v > hi) ? hi : v;
+		s[i] = (int)v;
+	}
+
+	return clipped;
+}
+
+static unsigned int gain_peak(const int *s, unsigned int n)
+{
+	int lo = 0;
+	int hi = 0;
+	unsigned int i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		lo = (s[i] < lo) ? s[i] : lo;
+		hi = (s[i] > hi) ? s[i] : hi;
+	}
+
+	return ((unsigned int)hi > -(unsigned int)lo) ? (unsigned int)hi : -(unsigned int)lo;
+}
+
+static int gain_block_read(struct GAIN_SOURCE *src, unsigned char *buffer, size_t size, off_t offset)
+{
+	ssize_t length = 0;
+
+	length = pread(src->file, buffer, size, offset);
+	if (length != size)
+	{
+		WAV_ERR("pread(%d, %lu, %ld) fail[%d]", src->file, (unsigned long)size, (long)offset, errno);
+		return (length < 0) ? -errno : -EIO;
+	}
+
+	return 0;
+}
+
+/************************************************************************************************************************/
+
+static void loud_biquad_init(struct LOUD_METER *meter, double rate)
+{
+	double f0 = 1681.974450955533;
+	double gain = 3.999843853973347;
+	double q = 0.7071752369554196;
+	double k = tan(M_PI * f0 / rate);
+	double vh = pow(10.0, gain / 20.0);
+	double vb = pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+
+	meter->shelf.b[0] = (vh + vb * k / q + k * k) / a0;
+	meter->shelf.b[1] = 2.0 * (k * k - vh) / a0;
+	meter->shelf.b[2] = (vh - vb * k / q + k * k) / a0;
+	meter->shelf.a[0] = 1.0;
+	meter->shelf.a[1] = 2.0 * (k * k - 1.0) / a0;
+	meter->shelf.a[2] = (1.0 - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / rate);
+	a0 = 1.0 + k / q + k * k;
+
+	meter->pass.b[0] = 1.0;
+	meter->pass.b[1] = -2.0;
+	meter->pass.b[2] = 1.0;
+	meter->pass.a[0] = 1.0;
+	meter->pass.a[1] = 2.0 * (k * k - 1.0) / a0;
+	meter->pass.a[2] = (1.0 - k / q + k * k) / a0;
+}
+
+static int loud_init(struct LOUD_METER *meter, unsigned int rate, unsigned int channels, unsigned int bytes)
+{
+	unsigned int c = 0;
+
+	memset(meter, 0, sizeof(struct LOUD_METER));
+
+	meter->state = (double (*)[4])calloc(channels, sizeof(double [4]));
+	meter->weight = (double *)malloc(channels * sizeof(double));
+	if ((meter->state == NULL) || (meter->weight == NULL))
+	{
+		WAV_ERR("malloc(%u) fail", channels);
+		return -ENOMEM;
+	}
+
+	/* 5.0/5.1按L R C (LFE) Ls Rs排列, 环绕声道权重1.41, LFE不计入 */
+	for (c = 0; c < channels; c++)
+		meter->weight[c] = 1.0;
+
+	if (channels == 5)
+	{
+		meter->weight[3] = 1.41;
+		meter->weight[4] = 1.41;
+	}
+	else if (channels == 6)
+	{
+		meter->weight[3] = 0.0;
+		meter->weight[4] = 1.41;
+		meter->weight[5] = 1.41;
+	}
+
+	loud_biquad_init(meter, rate);
+
+	meter->scale = 1.0 / (double)(1U << (bytes * 8 - 1));
+	meter->step = rate * LOUD_STEP_MS / 1000;
+	if (meter->step == 0)
+		meter->step = 1;
+
+	return 0;
+}
+
+static void loud_free(struct LOUD_METER *meter)
+{
+	free(meter->state);
+	free(meter->weight);
+	free(meter->steps);
+}
+
+static int loud_feed(struct LOUD_METER *meter, const int *s, unsigned int frames, unsigned int channels)
+{
+	const struct LOUD_BIQUAD *p = &(meter->shelf);
+	const struct LOUD_BIQUAD *h = &(meter->pass);
+	unsigned int i = 0;
+	unsigned int c = 0;
+
+	for (i = 0; i < frames; i++)
+	{
+		for (c = 0; c < channels; c++)
+		{
+			double *z = meter->state[c];
+			double x = s[i * channels + c] * meter->scale;
+			double y = 0;
+
+			/* 直接II型转置 */
+			y = p->b[0] * x + z[0];
+			z[0] = p->b[1] * x - p->a[1] * y + z[1];
+			z[1] = p->b[2] * x - p->a[2] * y;
+
+			x = y;
+			y = h->b[0] * x + z[2];
+			z[2] = h->b[1] * x - h->a[1] * y + z[3];
+			z[3] = h->b[2] * x - h->a[2] * y;
+
+			meter->energy += meter->weight[c] * y * y;
+		}
+
+		if (++meter->count < meter->step)
+			continue;
+
+		if (meter->nsteps == meter->capacity)
+		{
+			unsigned int capacity = meter->capacity ? meter->capacity * 2 : 1024;
+			double *steps = (double *)realloc(meter->steps, capacity * sizeof(double));
+
+			if (steps == NULL)
+			{
+				WAV_ERR("realloc(%u) fail", capacity);
+				return -ENOMEM;
+			}
+
+			meter->steps = steps;
+			meter->capacity = capacity;
+		}
+
+		meter->steps[meter->nsteps++] = meter->energy;
+		meter->energy = 0;
+		meter->count = 0;
+	}
+
+	return 0;
+}
+
+/* 400ms块先过-70LUFS绝对门限, 再过比其均值低10LU的相对门限 */
+static double loud_result(struct LOUD_METER *meter)
+{
+	double block = (double)meter->step * LOUD_BLOCK_STEPS;
+	double absolute = 0;
+	double relative = 0;
+	double sum = 0;
+	unsigned int count = 0;
+	unsigned int pass = 0;
+	unsigned int j = 0;
+
+	absolute = pow(10.0, (LOUD_ABS_GATE + 0.691) / 10.0);
+
+	for (pass = 0; pass < 2; pass++)
+	{
+		sum = 0;
+		count = 0;
+
+		for (j = 0; j + LOUD_BLOCK_STEPS <= meter->nsteps; j++)
+		{
+			double z = (meter->steps[j] + meter->steps[j + 1] +
+						meter->steps[j + 2] + meter->steps[j + 3]) / block;
+
+			if ((z > absolute) && (z > relative))
+			{
+				sum += z;
+				count++;
+			}
+		}
+
+		if (count == 0)
+			return -HUGE_VAL;
+
+		/* 相对门限是绝对门限内均值再降10LU, 可能低于-70LUFS, 第二轮两个门限都要满足 */
+		relative = sum / count * pow(10.0, LOUD_REL_GATE / 10.0);
+	}
+
+	return -0.691 + 10.0 * log10(sum / count);
+}
+
+/************************************************************************************************************************/
+
+static int gain_measure(struct GAIN_SOURCE *src, WAV_LEVEL *level)
+{
+	struct LOUD_METER meter;
+	unsigned int frame = src->bytes * src->channels;
+	unsigned int block = GAIN_BLOCK_SIZE / frame * frame;
+	unsigned char *buffer = NULL;
+	unsigned int peak = 0;
+	unsigned int max = 0;
+	unsigned int size = 0;
+	unsigned int n = 0;
+	unsigned int offset = 0;
+	int *samples = NULL;
+	int retval = 0;
+
+	if (block == 0)
+		block = frame;
+
+	retval = loud_init(&meter, src->header.fmts.sampleRate, src->channels, src->bytes);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	buffer = (unsigned char *)malloc(block);
+	samples = (int *)malloc(block / src->bytes * sizeof(int));
+	if ((buffer == NULL) || (samples == NULL))
+	{
+		WAV_ERR("malloc(%u) fail", block);
+		retval = -ENOMEM;
+		goto ERR_EXIT;
+	}
+
+	for (offset = 0; offset < src->dataSize; offset += size)
+	{
+		size = (src->dataSize - offset > block) ? block : src->dataSize - offset;
+		n = size / src->bytes;
+
+		retval = gain_block_read(src, buffer, size, src->dataOffset + offset);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		gain_load(buffer, samples, n, src->bytes);
+
+		max = gain_peak(samples, n);
+		peak = (max > peak) ? max : peak;
+
+		retval = loud_feed(&meter, samples, n / src->channels, src->channels);
+		if (retval < 0)
+			goto ERR_EXIT;
+	}
+
+	level->peak = peak ? 20.0 * log10(peak * meter.scale) : -HUGE_VAL;
+	level->loudness = loud_result(&meter);
+	level->gain = 0;
+
+ERR_EXIT:
+	loud_free(&meter);
+	free(buffer);
+	free(samples);
+
+	return retval;
+}
+
+static int gain_process(struct GAIN_SOURCE *src, double db)
+{
+	unsigned int frame = src->bytes * src->channels;
+	unsigned int block = GAIN_BLOCK_SIZE / frame * frame;
+	unsigned char *buffer = NULL;
+	unsigned long long clipped = 0;
+	double linear = pow(10.0, db / 20.0);
+	long long gain = 0;
+	int shift = GAIN_SHIFT;
+	unsigned int size = 0;
+	unsigned int n = 0;
+	unsigned int offset = 0;
+	int *samples = NULL;
+	ssize_t length = 0;
+	int retval = 0;
+
+	if (block == 0)
+		block = frame;
+
+	/* 放大时减少小数位, 保证定点增益不超过31bit, 乘积不溢出64bit */
+	if (linear > 1.0)
+		shift -= (int)ceil(log2(linear));
+
+	gain = llround(ldexp(linear, shift));
+
+	buffer = (unsigned char *)malloc(block);
+	samples = (int *)malloc(block / src->bytes * sizeof(int));
+	if ((buffer == NULL) || (samples == NULL))
+	{
+		WAV_ERR("malloc(%u) fail", block);
+		retval = -ENOMEM;
+		goto ERR_EXIT;
+	}
+
+	for (offset = 0; offset < src->dataSize; offset += size)
+	{
+		size = (src->dataSize - offset > block) ? block : src->dataSize - offset;
+		n = size / src->bytes;
+
+		retval = gain_block_read(src, buffer, size, src->dataOffset + offset);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		gain_load(buffer, samples, n, src->bytes);
+		clipped += gain_apply(samples, n, gain, shift, src->lo, src->hi);
+		gain_store(samples, buffer, n, src->bytes);
+
+		/* 原位写回同一区间, 不需要临时文件 */
+		length = pwrite(src->file, buffer, size, src->dataOffset + offset);
+		if (length != size)
+		{
+			WAV_ERR("pwrite(%d, %u, %ld) fail[%d]",
+				src->file, size, (long)(src->dataOffset + offset), errno);
+			retval = (length < 0) ? -errno : -EIO;
+			goto ERR_EXIT;
+		}
+	}
+
+	if (clipped)
+		WAV_WRN("%llu samples clipped by gain %.2fdB", clipped, db);
+
+	retval = (clipped > INT_MAX) ? INT_MAX : (int)clipped;
+
+ERR_EXIT:
+	free(buffer);
+	free(samples);
+
+	return retval;
+}
+
+/* 保存的hash块随payload一起更新, 否则校验会失败 */
+static int gain_refresh(const char *name, int clipped)
+{
+	int retval = 0;
+
+	retval = wave_hash_refresh(name);
+	if (retval < 0)
+		return retval;
+
+	return clipped;
+}
+
+/************************************************************************************************************************/
+
+int miniwave_level(const char *name, WAV_LEVEL *level)
+{
+	struct GAIN_SOURCE src;
+	int retval = 0;
+
+	if ((name == NULL) || (level == NULL))
+	{
+		WAV_ERR("Invalid name[%p] level[%p]", name, level);
+		return -EINVAL;
+	}
+
+	retval = gain_source_open(&src, name, O_RDONLY);
+	if (retval < 0)
+		return retval;
+
+	retval = gain_measure(&src, level);
+
+	close(src.file);
+
+	return retval;
+}
+
+int miniwave_gain(const char *name, double gain)
+{
+	struct GAIN_SOURCE src;
+	int retval = 0;
+
+	if ((name == NULL) || isnan(gain) || (gain > GAIN_MAX_DB))
+	{
+		WAV_ERR("Invalid name[%p] gain[%f]", name, gain);
+		return -EINVAL;
+	}
+
+	retval = gain_source_open(&src, name, O_RDWR);
+	if (retval < 0)
+		return retval;
+
+	if (gain != 0.0)
+		retval = gain_process(&src, gain);
+
+	close(src.file);
+
+	if ((gain != 0.0) && (retval >= 0))
+		retval = gain_refresh(name, retval);
+
+	return retval;
+}
+
+int miniwave_normalize(const char *name, int mode, double target, double ceiling, WAV_LEVEL *level)
+{
+	struct GAIN_SOURCE src;
+	WAV_LEVEL measure;
+	double gain = 0;
+	int retval = 0;
+
+	if ((name == NULL) || isnan(target) || isnan(ceiling) ||
+		((mode != WAVE_NORM_PEAK) && (mode != WAVE_NORM_LOUDNESS)))
+	{
+		WAV_ERR("Invalid name[%p] mode[%d] target[%f] ceiling[%f]", name, mode, target, ceiling);
+		return -EINVAL;
+	}
+
+	if (level == NULL)
+		level = &measure;
+
+	retval = gain_source_open(&src, name, O_RDWR);
+	if (retval < 0)
+		return retval;
+
+	retval = gain_measure(&src, level);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	if ((mode == WAVE_NORM_PEAK) ? isinf(level->peak) : isinf(level->loudness))
+	{
+		WAV_WRN("%s is silent, skip normalize", name);
+		goto ERR_EXIT;
+	}
+
+	gain = target - ((mode == WAVE_NORM_PEAK) ? level->peak : level->loudness);
+
+	/* 响度归一化后峰值不能越过ceiling, 按峰值收回增益而不是削顶 */
+	if (level->peak + gain > ceiling)
+		gain = ceiling - level->peak;
+
+	if (gain > GAIN_MAX_DB)
+		gain = GAIN_MAX_DB;
+
+	level->gain = gain;
+
+	if (fabs(gain) >= 0.005)
+	{
+		retval = gain_process(&src, gain);
+		if (retval >= 0)
+		{
+			close(src.file);
+			return gain_refresh(name, retval);
+		}
+	}
+
+ERR_EXIT:
+	close(src.file);
+
+	return retval;
+}
@@ -0,0 +1,837 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "miniwave.h"
+#include "miniwave_private.h"
+
+/************************************************************************************************************************/
+
+#define HASH_TYPE			"hash"
+#define HASH_VERSION		1
+#define HASH_LEAF			(1024 * 1024)		// 每段payload字节数, 写入hash块, 校验时按块里的值
+#define HASH_LEAF_MAX		(64 * 1024 * 1024)
+#define HASH_READ_SIZE		(256 * 1024)
+
+#define XXH_PRIME1	0x9E3779B185EBCA87ULL
+#define XXH_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3	0x165667B19E3779F9ULL
+#define XXH_PRIME4	0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5	0x27D4EB2F165667C5ULL
+
+/* hash块内容, 后面跟leaves个段摘要 */
+struct HASH_CHUNK
+{
+	unsigned int version;
+	unsigned int leaf;
+	unsigned long long bytes;
+	unsigned long long root;
+};
+
+struct HASH_JOB
+{
+	int file;
+	off_t offset;				// payload起始偏移
+	unsigned long long size;	// payload字节数
+	unsigned int leaf;
+	unsigned int count;			// 段数
+	unsigned int next;			// 工作线程原子领取
+	unsigned long long *leaves;
+	int error;
+};
+
+/************************************************************************************************************************/
+
+static inline unsigned long long xxh_rotl(unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long xxh_read64(const unsigned char *p)
+{
+	unsigned long long v = 0;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline unsigned int xxh_read32(const unsigned char *p)
+{
+	unsigned int v = 0;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline unsigned long long xxh_round(unsigned long long acc, unsigned long long input)
+{
+	acc += input * XXH_PRIME2;
+	acc = xxh_rotl(acc, 31);
+
+	return acc * XXH_PRIME1;
+}
+
+static inline unsigned long long xxh_merge(unsigned long long acc, unsigned long long val)
+{
+	acc ^= xxh_round(0, val);
+
+	return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static void xxh64_init(struct WAVE_XXH64 *s, unsigned long long seed)
+{
+	memset(s, 0, sizeof(struct WAVE_XXH64));
+
+	s->seed = seed;
+	s->acc[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+	s->acc[1] = seed + XXH_PRIME2;
+	s->acc[2] = seed;
+	s->acc[3] = seed - XXH_PRIME1;
+}
+
+/* 四路累加器互不依赖, 每轮32字节, 乘法延迟可以流水重叠 */
+static const unsigned char *xxh64_stripes(unsigned long long *acc, const unsigned char *p, const unsigned char *end)
+{
+	unsigned long long v0 = acc[0];
+	unsigned long long v1 = acc[1];
+	unsigned long long v2 = acc[2];
+	unsigned long long v3 = acc[3];
+
+	while (p + 32 <= end)
+	{
+		v0 = xxh_round(v0, xxh_read64(p));
+		v1 = xxh_round(v1, xxh_read64(p + 8));
+		v2 = xxh_round(v2, xxh_read64(p + 16));
+		v3 = xxh_round(v3, xxh_read64(p + 24));
+		p += 32;
+	}
+
+	acc[0] = v0;
+	acc[1] = v1;
+	acc[2] = v2;
+	acc[3] = v3;
+
+	return p;
+}
+
+static void xxh64_update(struct WAVE_XXH64 *s, const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + len;
+	unsigned int fill = 0;
+
+	if (len == 0)
+		return;
+
+	s->total += len;
+
+	if (s->memsize + len < 32)
+	{
+		memcpy(s->mem + s->memsize, p, len);
+		s->memsize += len;
+		return;
+	}
+
+	if (s->memsize)
+	{
+		fill = 32 - s->memsize;
+		memcpy(s->mem + s->memsize, p, fill);
+		xxh64_stripes(s->acc, s->mem, s->mem + 32);
+		p += fill;
+		s->memsize = 0;
+	}
+
+	p = xxh64_stripes(s->acc, p, end);
+
+	if (p < end)
+	{
+		memcpy(s->mem, p, end - p);
+		s->memsize = end - p;
+	}
+}
+
+static unsigned long long xxh64_digest(const struct WAVE_XXH64 *s)
+{
+	const unsigned char *p = s->mem;
+	const unsigned char *end = s->mem + s->memsize;
+	unsigned long long h = 0;
+
+	if (s->total >= 32)
+	{
+		h = xxh_rotl(s->acc[0], 1) + xxh_rotl(s->acc[1], 7) +
+			xxh_rotl(s->acc[2], 12) + xxh_rotl(s->acc[3], 18);
+		h = xxh_merge(h, s->acc[0]);
+		h = xxh_merge(h, s->acc[1]);
+		h = xxh_merge(h, s->acc[2]);
+		h = xxh_merge(h, s->acc[3]);
+	}
+	else
+	{
+		h = s->seed + XXH_PRIME5;
+	}
+
+	h += s->total;
+
+	for (; p + 8 <= end; p += 8)
+	{
+		h ^= xxh_round(0, xxh_read64(p));
+		h = xxh_rotl(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+	}
+
+	if (p + 4 <= end)
+	{
+		h ^= (unsigned long long)xxh_read32(p) * XXH_PRIME1;
+		h = xxh_rotl(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+		p += 4;
+	}
+
+	for (; p < end; p++)
+	{
+		h ^= (*p) * XXH_PRIME5;
+		h = xxh_rotl(h, 11) * XXH_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_PRIME2;
+	h ^= h >> 29;
+	h *= XXH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+static unsigned long long xxh64(const void *buf, size_t len, unsigned long long seed)
+{
+	struct WAVE_XXH64 s;
+
+	xxh64_init(&s, seed);
+	xxh64_update(&s, (const unsigned char *)buf, len);
+
+	return xxh64_digest(&s);
+}
+
+/* 根 = XXH64(各段摘要 || payload总长), 段i以i为种子, 段的顺序和长度都参与 */
+static unsigned long long hash_root(const unsigned long long *leaves, unsigned int count, unsigned long long bytes)
+{
+	struct WAVE_XXH64 s;
+
+	xxh64_init(&s, 0);
+	xxh64_update(&s, (const unsigned char *)leaves, count * sizeof(unsigned long long));
+	xxh64_update(&s, (const unsigned char *)&bytes, sizeof(bytes));
+
+	return xxh64_digest(&s);
+}
+
+/************************************************************************************************************************/
+
+struct WAVE_HASH *wave_hash_open(unsigned int leaf)
+{
+	struct WAVE_HASH *hash = NULL;
+
+	hash = (struct WAVE_HASH *)calloc(1, sizeof(struct WAVE_HASH));
+	if (hash == NULL)
+	{
+		WAV_ERR("calloc(%lu) fail", sizeof(struct WAVE_HASH));
+		return NULL;
+	}
+
+	hash->leaf = leaf ? leaf : HASH_LEAF;
+	xxh64_init(&(hash->state), 0);
+
+	return hash;
+}
+
+void wave_hash_close(struct WAVE_HASH *hash)
+{
+	if (hash == NULL)
+		return;
+
+	free(hash->leaves);
+	free(hash);
+}
+
+void wave_hash_reset(struct WAVE_HASH *hash, int broken)
+{
+	hash->length = 0;
+	hash->bytes = 0;
+	hash->count = 0;
+	hash->broken = broken;
+	xxh64_init(&(hash->state), 0);
+}
+
+static int hash_leaf_push(struct WAVE_HASH *hash, unsigned long long digest)
+{
+	if (hash->count == hash->capacity)
+	{
+		unsigned int capacity = hash->capacity ? hash->capacity * 2 : 64;
+		unsigned long long *leaves = NULL;
+
+		leaves = (unsigned long long *)realloc(hash->leaves, capacity * sizeof(unsigned long long));
+		if (leaves == NULL)
+		{
+			WAV_ERR("realloc(%u) fail", capacity);
+			return -ENOMEM;
+		}
+
+		hash->leaves = leaves;
+		hash->capacity = capacity;
+	}
+
+	hash->leaves[hash->count++] = digest;
+
+	return 0;
+}
+
+void wave_hash_update(struct WAVE_HASH *hash, const void *buf, unsigned int len)
+{
+	const unsigned char *p = (const unsigned char *)buf;
+	unsigned int n = 0;
+
+	while (len > 0)
+	{
+		n = hash->leaf - hash->length;
+		if (n > len)
+			n = len;
+
+		xxh64_update(&(hash->state), p, n);
+		hash->length += n;
+		hash->bytes += n;
+		p += n;
+		len -= n;
+
+		if (hash->length == hash->leaf)
+		{
+			/* 内存不足时结果作废, 不影响正常读写 */
+			if (hash_leaf_push(hash, xxh64_digest(&(hash->state))) < 0)
+				hash->broken = 1;
+
+			hash->length = 0;
+			xxh64_init(&(hash->state), hash->count);
+		}
+	}
+}
+
+void wave_hash_updatev(struct WAVE_HASH *hash, const struct iovec *iov, int iovcnt, unsigned int len)
+{
+	unsigned int n = 0;
+	int i = 0;
+
+	for (i = 0; (i < iovcnt) && (len > 0); i++)
+	{
+		n = (iov[i].iov_len < len) ? iov[i].iov_len : len;
+		wave_hash_update(hash, iov[i].iov_base, n);
+		len -= n;
+	}
+}
+
+/* 不改变流式状态, 可以在读写过程中随时取当前结果 */
+static int hash_final(struct WAVE_HASH *hash, WAV_HASH *out)
+{
+	if (hash->broken)
+		return -ESPIPE;
+
+	/* 未满的末段摘要暂放在leaves[count], 不计入count */
+	if (hash->length)
+	{
+		if (hash_leaf_push(hash, xxh64_digest(&(hash->state))) < 0)
+			return -ENOMEM;
+		hash->count--;
+	}
+
+	out->bytes = hash->bytes;
+	out->leaves = hash->count + (hash->length ? 1 : 0);
+	out->root = hash_root(hash->leaves, out->leaves, out->bytes);
+
+	return 0;
+}
+
+int wave_hash_flush(struct WAVE *wave)
+{
+	struct HASH_CHUNK *chunk = NULL;
+	WAV_HASH result;
+	unsigned int size = 0;
+	int retval = 0;
+
+	retval = hash_final(wave->hash, &result);
+	if (retval < 0)
+	{
+		WAV_WRN("Payload hash unavailable[%d], skip hash chunk", retval);
+		return retval;
+	}
+
+	size = sizeof(struct HASH_CHUNK) + result.leaves * sizeof(unsigned long long);
+
+	chunk = (struct HASH_CHUNK *)malloc(size);
+	if (chunk == NULL)
+	{
+		WAV_ERR("malloc(%u) fail", size);
+		return -ENOMEM;
+	}
+
+	chunk->version = HASH_VERSION;
+	chunk->leaf = wave->hash->leaf;
+	chunk->bytes = result.bytes;
+	chunk->root = result.root;
+	memcpy(chunk + 1, wave->hash->leaves, result.leaves * sizeof(unsigned long long));
+
+	retval = wave_trailer_write(wave, HASH_TYPE, chunk, size);
+
+	free(chunk);
+
+	return retval;
+}
+
+/************************************************************************************************************************/
+
+static void *hash_worker(void *arg)
+{
+	struct HASH_JOB *job = (struct HASH_JOB *)arg;
+	unsigned char *buffer = NULL;
+	unsigned long long offset = 0;
+	unsigned int size = 0;
+	unsigned int index = 0;
+	ssize_t length = 0;
+	size_t done = 0;
+
+	buffer = (unsigned char *)malloc(job->leaf);
+	if (buffer == NULL)
+	{
+		WAV_ERR("malloc(%u) fail", job->leaf);
+		__atomic_store_n(&job->error, -ENOMEM, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	while (__atomic_load_n(&job->error, __ATOMIC_RELAXED) == 0)
+	{
+		index = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (index >= job->count)
+			break;
+
+		offset = (unsigned long long)index * job->leaf;
+		size = (job->size - offset > job->leaf) ? job->leaf : job->size - offset;
+
+		for (done = 0; done < size; done += length)
+		{
+			length = pread(job->file, buffer + done, size - done, job->offset + offset + done);
+			if (length <= 0)
+			{
+				WAV_ERR("pread(%d, %u, %llu) fail[%d]", job->file, size, offset, errno);
+				__atomic_store_n(&job->error, (length < 0) ? -errno : -EIO, __ATOMIC_RELAXED);
+				goto EXIT;
+			}
+		}
+
+		job->leaves[index] = xxh64(buffer, size, index);
+	}
+
+EXIT:
+	free(buffer);
+
+	return NULL;
+}
+
+/* 线性PCM直接按段pread, 多线程并行计算各段摘要 */
+static int hash_compute_pcm(int file, off_t offset, unsigned long long size, unsigned int leaf,
+				unsigned long long **leaves, WAV_HASH *hash)
+{
+	struct HASH_JOB job;
+	pthread_t threads[CONFIG_LIBRARY_MINIWAVE_HASH_THREADS];
+	unsigned int count = 0;
+	long online = 0;
+	int started = 0;
+	int i = 0;
+
+	memset(&job, 0, sizeof(job));
+	job.file = file;
+	job.offset = offset;
+	job.size = size;
+	job.leaf = leaf;
+	job.count = (size + leaf - 1) / leaf;
+
+	job.leaves = (unsigned long long *)malloc((job.count + 1) * sizeof(unsigned long long));
+	if (job.leaves == NULL)
+	{
+		WAV_ERR("malloc(%u) fail", job.count);
+		return -ENOMEM;
+	}
+
+	count = CONFIG_LIBRARY_MINIWAVE_HASH_THREADS;
+
+	online = sysconf(_SC_NPROCESSORS_ONLN);
+	if ((online > 0) && (count > online))
+		count = online;
+	if (count > job.count)
+		count = job.count;
+
+	/* 调用线程自己也算一个 */
+	for (i = 1; i < count; i++)
+	{
+		if (pthread_create(&threads[started], NULL, hash_worker, &job) != 0)
+		{
+			WAV_WRN("pthread_create fail[%d], continue with %d threads", errno, started + 1);
+			break;
+		}
+		started++;
+	}
+
+	hash_worker(&job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	if (job.error < 0)
+	{
+		free(job.leaves);
+		return job.error;
+	}
+
+	hash->bytes = size;
+	hash->leaves = job.count;
+	hash->root = hash_root(job.leaves, job.count, size);
+
+	*leaves = job.leaves;
+
+	return 0;
+}
+
+/* 压缩格式只能顺序解码, 对解码出的PCM计算 */
+static int hash_compute_codec(const char *name, unsigned int leaf,
+				unsigned long long **leaves, WAV_HASH *hash)
+{
+	struct WAVE_HASH *state = NULL;
+	unsigned char *buffer = NULL;
+	WAV_ATTR attr;
+	WAV wav = NULL;
+	unsigned int size = 0;
+	int retval = 0;
+
+	wav = miniwave_open(name, WAVE_O_RDONLY, &attr);
+	if (wav == NULL)
+		return -EPERM;
+
+	size = attr.channels * attr.sampbits / 8;
+	size = size ? HASH_READ_SIZE / size * size : HASH_READ_SIZE;
+
+	state = wave_hash_open(leaf);
+	buffer = (unsigned char *)malloc(size);
+	if ((state == NULL) || (buffer == NULL))
+	{
+		WAV_ERR("malloc(%u) fail", size);
+		retval = -ENOMEM;
+		goto ERR_EXIT;
+	}
+
+	miniwave_readahead(wav, 0, 0);
+
+	while ((retval = miniwave_read(wav, buffer, size)) > 0)
+		wave_hash_update(state, buffer, retval);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	retval = hash_final(state, hash);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	*leaves = state->leaves;
+	state->leaves = NULL;
+
+ERR_EXIT:
+	wave_hash_close(state);
+	free(buffer);
+	miniwave_close(wav);
+
+	return retval;
+}
+
+static int hash_compute(const char *name, unsigned int leaf, unsigned long long **leaves, WAV_HASH *hash)
+{
+	struct WAVE_HEADER header;
+	struct stat st;
+	unsigned long long size = 0;
+	off_t offset = 0;
+	int file = -1;
+	int retval = 0;
+
+	file = open(name, O_RDONLY);
+	if (file < 0)
+	{
+		WAV_ERR("open(%s, O_RDONLY) fail[%d]", name, errno);
+		return -errno;
+	}
+
+	retval = wave_header_read(file, &header, NULL);
+	if (retval < 0)
+		goto EXIT;
+
+	offset = retval;
+
+	if (header.fmts.compressionCode != WAVE_FORMAT_PCM)
+	{
+		close(file);
+		return hash_compute_codec(name, leaf, leaves, hash);
+	}
+
+	/* 和顺序读一致: payload以dataSize为准, 截断的文件到实际结尾为止 */
+	size = header.data.dataSize;
+	if ((fstat(file, &st) == 0) && (offset + (off_t)size > st.st_size))
+		size = (st.st_size > offset) ? st.st_size - offset : 0;
+
+	retval = hash_compute_pcm(file, offset, size, leaf, leaves, hash);
+
+EXIT:
+	close(file);
+
+	return retval;
+}
+
+/* 定位data块之后的hash块, 返回内容偏移 */
+static off_t hash_locate(int file, unsigned int *size)
+{
+	struct WAVE_HEADER header;
+	int retval = 0;
+
+	retval = wave_header_read(file, &header, NULL);
+	if (retval < 0)
+		return retval;
+
+	return wave_trailer_find(file, retval + (off_t)header.data.dataSize, HASH_TYPE, size);
+}
+
+/* 读取文件中保存的hash块, leaves可为NULL */
+static int hash_load(const char *name, WAV_HASH *hash, unsigned int *leaf, unsigned long long **leaves)
+{
+	struct HASH_CHUNK chunk;
+	unsigned int size = 0;
+	off_t position = 0;
+	int file = -1;
+	int retval = 0;
+
+	file = open(name, O_RDONLY);
+	if (file < 0)
+	{
+		WAV_ERR("open(%s, O_RDONLY) fail[%d]", name, errno);
+		return -errno;
+	}
+
+	position = hash_locate(file, &size);
+	if (position < 0)
+	{
+		retval = (int)position;
+		goto EXIT;
+	}
+
+	if ((size < sizeof(chunk)) ||
+		(pread(file, &chunk, sizeof(chunk), position) != sizeof(chunk)) ||
+		(chunk.version != HASH_VERSION) || (chunk.leaf == 0) || (chunk.leaf > HASH_LEAF_MAX) ||
+		(size != sizeof(chunk) + (chunk.bytes + chunk.leaf - 1) / chunk.leaf * sizeof(unsigned long long)))
+	{
+		WAV_ERR("Invalid hash chunk in %s", name);
+		retval = -EBADMSG;
+		goto EXIT;
+	}
+
+	hash->root = chunk.root;
+	hash->bytes = chunk.bytes;
+	hash->leaves = (size - sizeof(chunk)) / sizeof(unsigned long long);
+	*leaf = chunk.leaf;
+
+	if (leaves)
+	{
+		*leaves = (unsigned long long *)malloc(size - sizeof(chunk) + 1);
+		if (*leaves == NULL)
+		{
+			WAV_ERR("malloc(%u) fail", size);
+			retval = -ENOMEM;
+			goto EXIT;
+		}
+
+		if (pread(file, *leaves, size - sizeof(chunk), position + sizeof(chunk)) != size - sizeof(chunk))
+		{
+			WAV_ERR("pread(%d) hash leaves fail[%d]", file, errno);
+			free(*leaves);
+			*leaves = NULL;
+			retval = -EIO;
+			goto EXIT;
+		}
+	}
+
+	retval = 0;
+
+EXIT:
+	close(file);
+
+	return retval;
+}
+
+/* payload被原地改写后按原分段大小重新计算保存的hash块, 没有hash块时直接返回 */
+int wave_hash_refresh(const char *name)
+{
+	unsigned long long *leaves = NULL;
+	struct HASH_CHUNK chunk;
+	WAV_HASH hash;
+	unsigned int leaf = 0;
+	unsigned int size = 0;
+	off_t position = 0;
+	int file = -1;
+	int retval = 0;
+
+	retval = hash_load(name, &hash, &leaf, NULL);
+	if (retval < 0)
+		return (retval == -ENOENT) ? 0 : retval;
+
+	retval = hash_compute(name, leaf, &leaves, &hash);
+	if (retval < 0)
+		return retval;
+
+	file = open(name, O_RDWR);
+	if (file < 0)
+	{
+		WAV_ERR("open(%s, O_RDWR) fail[%d]", name, errno);
+		retval = -errno;
+		goto EXIT;
+	}
+
+	/* 增益不改变payload长度, 段数不变, 原位覆盖 */
+	position = hash_locate(file, &size);
+	if ((position < 0) || (size != sizeof(chunk) + hash.leaves * sizeof(unsigned long long)))
+	{
+		WAV_ERR("Hash chunk of %s changed size", name);
+		retval = -EBADMSG;
+		goto EXIT;
+	}
+
+	chunk.version = HASH_VERSION;
+	chunk.leaf = leaf;
+	chunk.bytes = hash.bytes;
+	chunk.root = hash.root;
+
+	if ((pwrite(file, &chunk, sizeof(chunk), position) != sizeof(chunk)) ||
+		(pwrite(file, leaves, size - sizeof(chunk), position + sizeof(chunk)) != size - sizeof(chunk)))
+	{
+		WAV_ERR("pwrite(%d) hash chunk fail[%d]", file, errno);
+		retval = -EIO;
+		goto EXIT;
+	}
+
+	retval = 0;
+
+EXIT:
+	if (file >= 0)
+		close(file);
+
+	free(leaves);
+
+	return retval;
+}
+
+/************************************************************************************************************************/
+
+int miniwave_hash(WAV wav, WAV_HASH *hash)
+{
+	struct WAVE *wave = (struct WAVE *)wav;
+
+	if ((wav == NULL) || (hash == NULL) || (wave->hash == NULL))
+	{
+		WAV_ERR("Invalid wav[%p] hash[%p], open with WAVE_O_HASH", wav, hash);
+		return -EINVAL;
+	}
+
+	/* 录音时写盘线程在更新哈希状态 */
+	if (wave->cap)
+	{
+		WAV_ERR("Wave file is capturing, call after miniwave_capture_stop()");
+		return -EBUSY;
+	}
+
+	return hash_final(wave->hash, hash);
+}
+
+int miniwave_hash_file(const char *name, WAV_HASH *hash)
+{
+	unsigned long long *leaves = NULL;
+	int retval = 0;
+
+	if ((name == NULL) || (hash == NULL))
+	{
+		WAV_ERR("Invalid name[%p] hash[%p]", name, hash);
+		return -EINVAL;
+	}
+
+	retval = hash_compute(name, HASH_LEAF, &leaves, hash);
+
+	free(leaves);
+
+	return retval;
+}
+
+int miniwave_hash_stored(const char *name, WAV_HASH *hash)
+{
+	unsigned int leaf = 0;
+
+	if ((name == NULL) || (hash == NULL))
+	{
+		WAV_ERR("Invalid name[%p] hash[%p]", name, hash);
+		return -EINVAL;
+	}
+
+	return hash_load(name, hash, &leaf, NULL);
+}
+
+int miniwave_hash_verify(const char *name)
+{
+	unsigned long long *stored = NULL;
+	unsigned long long *actual = NULL;
+	WAV_HASH expect;
+	WAV_HASH result;
+	unsigned int leaf = 0;
+	unsigned int i = 0;
+	int retval = 0;
+
+	if (name == NULL)
+	{
+		WAV_ERR("Invalid name[%p]", name);
+		return -EINVAL;
+	}
+
+	retval = hash_load(name, &expect, &leaf, &stored);
+	if (retval < 0)
+		return retval;
+
+	/* 按保存时的分段大小重新计算, 不一致时定位到段 */
+	retval = hash_compute(name, leaf, &actual, &result);
+	if (retval < 0)
+		goto EXIT;
+
+	if ((result.root == expect.root) && (result.bytes == expect.bytes))
+		goto EXIT;
+
+	for (i = 0; (i < result.leaves) && (i < expect.leaves); i++)
+	{
+		if (actual[i] != stored[i])
+			break;
+	}
+
+	WAV_ERR("%s payload mismatch at byte %llu, bytes[%llu] expect[%llu]",
+		name, (unsigned long long)i * leaf, result.bytes, expect.bytes);
+
+	retval = -EBADMSG;
+
+EXIT:
+	free(stored);
+	free(actual);
+
+	return retval;
+}
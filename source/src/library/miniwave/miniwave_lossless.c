@@ -0,0 +1,1641 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "miniwave.h"
+#include "miniwave_private.h"
+
+/************************************************************************************************************************/
+
+/*
+ * 无损压缩格式:
+ *   data块由连续的压缩帧组成, 每帧固定block个PCM帧(最后一帧可以不足),
+ *   帧头之后每个通道一个子帧, 子帧按常量/原样/固定多项式/LPC预测中
+ *   码长最短的一种编码, 残差分区后做Rice编码.
+ *   data块之后的seek块记录每个压缩帧的偏移, 缺失时按帧头顺序扫描重建.
+ */
+struct LOSSLESS_FRAME
+{
+	unsigned char sync[2];		// "LF"
+	unsigned char mode;			// 立体声去相关方式
+	unsigned char reserved;
+	unsigned short frames;		// 本帧PCM帧数
+	unsigned short reserved2;
+	unsigned int size;			// 本帧字节数, 含帧头
+};
+
+#define LOSSLESS_SYNC			"LF"
+#define LOSSLESS_FRAME_SIZE		sizeof(struct LOSSLESS_FRAME)
+#define LOSSLESS_SEEK_TYPE		"seek"
+
+#define LOSSLESS_MAX_ORDER		12		// LPC最高阶数
+#define LOSSLESS_FIXED_ORDER	4		// 固定多项式最高阶数
+#define LOSSLESS_PRECISION		15		// LPC系数量化位数
+#define LOSSLESS_MAX_SHIFT		15
+#define LOSSLESS_MAX_PARTITION	6		// 残差最多2^6个分区
+#define LOSSLESS_RICE_ESCAPE	31		// 分区内残差原样存储
+
+enum
+{
+	LOSSLESS_SUBFRAME_CONSTANT	= 0x00,
+	LOSSLESS_SUBFRAME_VERBATIM	= 0x01,
+	LOSSLESS_SUBFRAME_FIXED		= 0x02,	// +阶数(0~4)
+	LOSSLESS_SUBFRAME_LPC		= 0x20,	// +阶数-1
+};
+
+enum
+{
+	LOSSLESS_INDEPENDENT,
+	LOSSLESS_LEFT_SIDE,
+	LOSSLESS_SIDE_RIGHT,
+	LOSSLESS_MID_SIDE,
+};
+
+/* 残差的分区和Rice参数 */
+struct LOSSLESS_RICE
+{
+	unsigned int order;
+	unsigned char param[1 << LOSSLESS_MAX_PARTITION];
+	unsigned char width[1 << LOSSLESS_MAX_PARTITION];	// 转义分区的原样位宽
+};
+
+/* 子帧编码方案 */
+struct LOSSLESS_PLAN
+{
+	unsigned int type;
+	unsigned int order;
+	unsigned int precision;
+	unsigned int shift;
+	int coef[LOSSLESS_MAX_ORDER];
+	struct LOSSLESS_RICE rice;
+	unsigned long long bits;
+};
+
+/************************************************************************************************************************/
+
+struct LOSSLESS_BITWRITER
+{
+	unsigned char *data;
+	unsigned int size;
+	unsigned int pos;
+	unsigned long long acc;
+	unsigned int bits;
+	int overflow;
+};
+
+static inline void lossless_put(struct LOSSLESS_BITWRITER *bw, unsigned int value, unsigned int bits)
+{
+	if (bits == 0)
+		return;
+
+	bw->acc = (bw->acc << bits) | (value & ((1ULL << bits) - 1));
+	bw->bits += bits;
+
+	while (bw->bits >= 8)
+	{
+		bw->bits -= 8;
+		if (bw->pos < bw->size)
+			bw->data[bw->pos++] = (unsigned char)(bw->acc >> bw->bits);
+		else
+			bw->overflow = 1;
+	}
+}
+
+static inline void lossless_put_rice(struct LOSSLESS_BITWRITER *bw, unsigned int value, unsigned int k)
+{
+	unsigned int q = value >> k;
+
+	while (q >= 32)
+	{
+		lossless_put(bw, 0, 32);
+		q -= 32;
+	}
+
+	lossless_put(bw, 1, q + 1);
+	lossless_put(bw, value, k);
+}
+
+static void lossless_put_align(struct LOSSLESS_BITWRITER *bw)
+{
+	if (bw->bits)
+		lossless_put(bw, 0, 8 - bw->bits);
+}
+
+struct LOSSLESS_BITREADER
+{
+	const unsigned char *data;
+	unsigned int size;
+	unsigned int pos;
+	unsigned long long acc;		// 左对齐
+	unsigned int bits;
+	int error;
+};
+
+static inline void lossless_fill(struct LOSSLESS_BITREADER *br)
+{
+	while ((br->bits <= 56) && (br->pos < br->size))
+	{
+		br->acc |= (unsigned long long)br->data[br->pos++] << (56 - br->bits);
+		br->bits += 8;
+	}
+}
+
+static inline unsigned int lossless_get(struct LOSSLESS_BITREADER *br, unsigned int bits)
+{
+	unsigned int value = 0;
+
+	if (bits == 0)
+		return 0;
+
+	if (br->bits < bits)
+	{
+		lossless_fill(br);
+		if (br->bits < bits)
+		{
+			br->error = 1;
+			return 0;
+		}
+	}
+
+	value = (unsigned int)(br->acc >> (64 - bits));
+	br->acc <<= bits;
+	br->bits -= bits;
+
+	return value;
+}
+
+static inline int lossless_get_signed(struct LOSSLESS_BITREADER *br, unsigned int bits)
+{
+	unsigned int value = lossless_get(br, bits);
+
+	if ((bits == 0) || (bits >= 32))
+		return (int)value;
+
+	return (int)(value << (32 - bits)) >> (32 - bits);
+}
+
+static inline unsigned int lossless_get_unary(struct LOSSLESS_BITREADER *br)
+{
+	unsigned int q = 0;
+	unsigned int zeros = 0;
+
+	for (;;)
+	{
+		if (br->bits == 0)
+		{
+			lossless_fill(br);
+			if (br->bits == 0)
+			{
+				br->error = 1;
+				return 0;
+			}
+		}
+
+		if (br->acc == 0)
+		{
+			q += br->bits;
+			br->bits = 0;
+			continue;
+		}
+
+		zeros = __builtin_clzll(br->acc);
+		q += zeros;
+		br->acc <<= zeros;
+		br->acc <<= 1;
+		br->bits -= zeros + 1;
+
+		return q;
+	}
+}
+
+/************************************************************************************************************************/
+
+static void lossless_pcm_unpack(const unsigned char *pcm, unsigned int frames, unsigned int channels,
+				unsigned int bits, int *samples, unsigned int stride)
+{
+	unsigned int i = 0;
+	unsigned int c = 0;
+
+	for (c = 0; c < channels; c++)
+	{
+		const unsigned char *p = pcm + c * (bits / 8);
+		int *x = samples + c * stride;
+
+		switch (bits)
+		{
+		case 8:
+			for (i = 0; i < frames; i++, p += channels)
+				x[i] = (int)p[0] - 128;
+			break;
+		case 16:
+			for (i = 0; i < frames; i++, p += 2 * channels)
+				x[i] = (short)(p[0] | (p[1] << 8));
+			break;
+		case 24:
+			for (i = 0; i < frames; i++, p += 3 * channels)
+				x[i] = (int)(((unsigned int)p[0] << 8) | ((unsigned int)p[1] << 16) |
+						((unsigned int)p[2] << 24)) >> 8;
+			break;
+		default:
+			for (i = 0; i < frames; i++, p += 4 * channels)
+				x[i] = (int)(p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24));
+			break;
+		}
+	}
+}
+
+static void lossless_pcm_pack(unsigned char *pcm, unsigned int frames, unsigned int channels,
+				unsigned int bits, const int *samples, unsigned int stride)
+{
+	unsigned int i = 0;
+	unsigned int c = 0;
+
+	for (c = 0; c < channels; c++)
+	{
+		unsigned char *p = pcm + c * (bits / 8);
+		const int *x = samples + c * stride;
+
+		switch (bits)
+		{
+		case 8:
+			for (i = 0; i < frames; i++, p += channels)
+				p[0] = (unsigned char)(x[i] + 128);
+			break;
+		case 16:
+			for (i = 0; i < frames; i++, p += 2 * channels)
+			{
+				p[0] = x[i];
+				p[1] = x[i] >> 8;
+			}
+			break;
+		case 24:
+			for (i = 0; i < frames; i++, p += 3 * channels)
+			{
+				p[0] = x[i];
+				p[1] = x[i] >> 8;
+				p[2] = x[i] >> 16;
+			}
+			break;
+		default:
+			for (i = 0; i < frames; i++, p += 4 * channels)
+			{
+				p[0] = x[i];
+				p[1] = x[i] >> 8;
+				p[2] = x[i] >> 16;
+				p[3] = x[i] >> 24;
+			}
+			break;
+		}
+	}
+}
+
+/************************************************************************************************************************/
+
+/* 固定多项式预测, order为0~4 */
+static inline long long lossless_fixed_predict(const int *x, unsigned int i, unsigned int order)
+{
+	switch (order)
+	{
+	case 0:
+		return 0;
+	case 1:
+		return x[i - 1];
+	case 2:
+		return 2LL * x[i - 1] - x[i - 2];
+	case 3:
+		return 3LL * x[i - 1] - 3LL * x[i - 2] + x[i - 3];
+	default:
+		return 4LL * x[i - 1] - 6LL * x[i - 2] + 4LL * x[i - 3] - x[i - 4];
+	}
+}
+
+static inline long long lossless_lpc_predict(const int *x, unsigned int i,
+				const int *coef, unsigned int order, unsigned int shift)
+{
+	long long sum = 0;
+	unsigned int j = 0;
+
+	for (j = 0; j < order; j++)
+		sum += (long long)coef[j] * x[i - 1 - j];
+
+	return sum >> shift;
+}
+
+static int lossless_residual_fixed(const int *x, unsigned int n, unsigned int order, int *residual)
+{
+	unsigned int i = 0;
+
+	for (i = order; i < n; i++)
+	{
+		long long r = x[i] - lossless_fixed_predict(x, i, order);
+
+		if ((r > 0x7FFFFFFFLL) || (r < -0x80000000LL))
+			return -ERANGE;
+
+		residual[i] = (int)r;
+	}
+
+	return 0;
+}
+
+static int lossless_residual_lpc(const int *x, unsigned int n, const int *coef,
+				unsigned int order, unsigned int shift, int *residual)
+{
+	unsigned int i = 0;
+
+	for (i = order; i < n; i++)
+	{
+		long long r = x[i] - lossless_lpc_predict(x, i, coef, order, shift);
+
+		if ((r > 0x7FFFFFFFLL) || (r < -0x80000000LL))
+			return -ERANGE;
+
+		residual[i] = (int)r;
+	}
+
+	return 0;
+}
+
+static inline unsigned int lossless_zigzag(int r)
+{
+	return ((unsigned int)r << 1) ^ (unsigned int)(r >> 31);
+}
+
+/*
+ * 选择残差分区数和各分区Rice参数. 码长按(sum >> k) + count * (k + 1)估算,
+ * 该值不小于实际码长, 因此选出的方案不会超过原样存储.
+ */
+static unsigned long long lossless_rice_plan(const int *residual, unsigned int n, unsigned int order,
+				struct LOSSLESS_RICE *rice)
+{
+	unsigned long long sums[1 << LOSSLESS_MAX_PARTITION];
+	unsigned int maxs[1 << LOSSLESS_MAX_PARTITION];
+	unsigned long long best = ~0ULL;
+	unsigned int maxorder = 0;
+	unsigned int po = 0;
+	unsigned int parts = 0;
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	while ((maxorder < LOSSLESS_MAX_PARTITION) && !(n & ((2U << maxorder) - 1)) &&
+		((n >> (maxorder + 1)) > order))
+		maxorder++;
+
+	/* 最细分区的残差和与最大值, 粗分区由相邻分区合并 */
+	parts = 1U << maxorder;
+	for (j = 0; j < parts; j++)
+	{
+		unsigned int start = (j == 0) ? order : j * (n >> maxorder);
+		unsigned int end = (j + 1) * (n >> maxorder);
+		unsigned long long sum = 0;
+		unsigned int max = 0;
+
+		for (i = start; i < end; i++)
+		{
+			unsigned int u = lossless_zigzag(residual[i]);
+
+			sum += u;
+			if (u > max)
+				max = u;
+		}
+
+		sums[j] = sum;
+		maxs[j] = max;
+	}
+
+	for (po = maxorder + 1; po-- > 0; )
+	{
+		struct LOSSLESS_RICE plan;
+		unsigned long long bits = 4;
+
+		plan.order = po;
+
+		for (j = 0; j < (1U << po); j++)
+		{
+			unsigned int span = 1U << (maxorder - po);
+			unsigned int count = (n >> po) - ((j == 0) ? order : 0);
+			unsigned long long sum = 0;
+			unsigned long long cost = 0;
+			unsigned long long escape = 0;
+			unsigned int max = 0;
+			unsigned int width = 0;
+			unsigned int k = 0;
+			unsigned int k0 = 0;
+
+			for (i = j * span; i < (j + 1) * span; i++)
+			{
+				sum += sums[i];
+				if (maxs[i] > max)
+					max = maxs[i];
+			}
+
+			width = max ? (32 - __builtin_clz(max)) : 0;
+			escape = 5 + 6 + (unsigned long long)count * width;
+
+			if (count && (sum > count))
+				k0 = 63 - __builtin_clzll(sum / count);
+			if (k0 > 30)
+				k0 = 30;
+
+			plan.param[j] = LOSSLESS_RICE_ESCAPE;
+			plan.width[j] = width;
+			cost = escape;
+
+			for (k = (k0 > 0) ? (k0 - 1) : 0; (k <= k0 + 1) && (k <= 30); k++)
+			{
+				unsigned long long c = 5 + (sum >> k) + (unsigned long long)count * (k + 1);
+
+				if (c < cost)
+				{
+					cost = c;
+					plan.param[j] = k;
+				}
+			}
+
+			bits += cost;
+		}
+
+		if (bits < best)
+		{
+			best = bits;
+			memcpy(rice, &plan, sizeof(struct LOSSLESS_RICE));
+		}
+	}
+
+	return best;
+}
+
+static void lossless_rice_write(struct LOSSLESS_BITWRITER *bw, const int *residual, unsigned int n,
+				unsigned int order, const struct LOSSLESS_RICE *rice)
+{
+	unsigned int size = n >> rice->order;
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	lossless_put(bw, rice->order, 4);
+
+	for (j = 0; j < (1U << rice->order); j++)
+	{
+		unsigned int start = (j == 0) ? order : j * size;
+		unsigned int end = (j + 1) * size;
+		unsigned int k = rice->param[j];
+
+		lossless_put(bw, k, 5);
+
+		if (k == LOSSLESS_RICE_ESCAPE)
+		{
+			lossless_put(bw, rice->width[j], 6);
+			for (i = start; i < end; i++)
+				lossless_put(bw, residual[i], rice->width[j]);
+		}
+		else
+		{
+			for (i = start; i < end; i++)
+				lossless_put_rice(bw, lossless_zigzag(residual[i]), k);
+		}
+	}
+}
+
+static int lossless_rice_read(struct LOSSLESS_BITREADER *br, int *residual, unsigned int n,
+				unsigned int order)
+{
+	unsigned int po = lossless_get(br, 4);
+	unsigned int size = n >> po;
+	unsigned int i = 0;
+	unsigned int j = 0;
+
+	if (br->error || ((size << po) != n) || (size < order))
+		return -EIO;
+
+	for (j = 0; j < (1U << po); j++)
+	{
+		unsigned int start = (j == 0) ? order : j * size;
+		unsigned int end = (j + 1) * size;
+		unsigned int k = lossless_get(br, 5);
+
+		if (k == LOSSLESS_RICE_ESCAPE)
+		{
+			unsigned int width = lossless_get(br, 6);
+
+			if (width > 32)
+				return -EIO;
+
+			for (i = start; i < end; i++)
+				residual[i] = lossless_get_signed(br, width);
+		}
+		else
+		{
+			for (i = start; i < end; i++)
+			{
+				unsigned int q = lossless_get_unary(br);
+				unsigned int u = 0;
+
+				if (q > (0xFFFFFFFFU >> k))
+					return -EIO;
+
+				u = (q << k) | lossless_get(br, k);
+				residual[i] = (int)(u >> 1) ^ -(int)(u & 1);
+			}
+		}
+
+		if (br->error)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+/************************************************************************************************************************/
+
+/* Welch窗自相关 + Levinson-Durbin, 按估算码长选阶数后量化系数 */
+static int lossless_lpc_analyze(const int *x, unsigned int n, unsigned int width, double *buffer,
+				struct LOSSLESS_PLAN *plan)
+{
+	double autoc[LOSSLESS_MAX_ORDER + 1];
+	double lpc[LOSSLESS_MAX_ORDER];
+	double coef[LOSSLESS_MAX_ORDER][LOSSLESS_MAX_ORDER];
+	double error[LOSSLESS_MAX_ORDER];
+	double err = 0;
+	double half = (n - 1) / 2.0;
+	double cmax = 0;
+	double best = 0;
+	double acc = 0;
+	unsigned int maxorder = LOSSLESS_MAX_ORDER;
+	unsigned int order = 0;
+	unsigned int i = 0;
+	unsigned int j = 0;
+	int log2cmax = 0;
+	int shift = 0;
+	int qmax = (1 << (LOSSLESS_PRECISION - 1)) - 1;
+
+	if (n <= 2 * maxorder)
+		return -EINVAL;
+
+	for (i = 0; i < n; i++)
+	{
+		double t = (i - half) / (half + 1);
+
+		buffer[i] = x[i] * (1.0 - t * t);
+	}
+
+	for (j = 0; j <= maxorder; j++)
+	{
+		double sum = 0;
+
+		for (i = j; i < n; i++)
+			sum += buffer[i] * buffer[i - j];
+
+		autoc[j] = sum;
+	}
+
+	if (autoc[0] <= 0)
+		return -EINVAL;
+
+	err = autoc[0];
+
+	for (i = 0; i < maxorder; i++)
+	{
+		double r = -autoc[i + 1];
+
+		for (j = 0; j < i; j++)
+			r -= lpc[j] * autoc[i - j];
+		r /= err;
+
+		lpc[i] = r;
+		for (j = 0; j < (i >> 1); j++)
+		{
+			double tmp = lpc[j];
+
+			lpc[j] += r * lpc[i - 1 - j];
+			lpc[i - 1 - j] += r * tmp;
+		}
+		if (i & 1)
+			lpc[j] += lpc[j] * r;
+
+		err *= (1.0 - r * r);
+
+		for (j = 0; j <= i; j++)
+			coef[i][j] = -lpc[j];
+		error[i] = err;
+
+		if (err <= 0)
+		{
+			maxorder = i + 1;
+			break;
+		}
+	}
+
+	/* 每个残差约0.5*log2(err/n)位, 加上系数和预热采样的开销 */
+	for (i = 0; i < maxorder; i++)
+	{
+		double bps = (error[i] > 0) ? (0.5 * log2(error[i] * 0.5 / n)) : 0;
+		double bits = 0;
+
+		if (bps < 0)
+			bps = 0;
+
+		bits = bps * (n - i - 1) + (i + 1) * (LOSSLESS_PRECISION + width);
+		if ((i == 0) || (bits < best))
+		{
+			best = bits;
+			order = i + 1;
+		}
+	}
+
+	for (j = 0; j < order; j++)
+	{
+		if (fabs(coef[order - 1][j]) > cmax)
+			cmax = fabs(coef[order - 1][j]);
+	}
+
+	if (cmax <= 0)
+		return -EINVAL;
+
+	frexp(cmax, &log2cmax);
+	log2cmax--;
+	shift = (LOSSLESS_PRECISION - 1) - log2cmax - 1;
+	if (shift > LOSSLESS_MAX_SHIFT)
+		shift = LOSSLESS_MAX_SHIFT;
+	if (shift < 0)
+		return -ERANGE;
+
+	/* 量化误差逐项向后传递 */
+	for (j = 0; j < order; j++)
+	{
+		long q = 0;
+
+		acc += coef[order - 1][j] * (1 << shift);
+		q = lround(acc);
+		if (q > qmax)
+			q = qmax;
+		if (q < -qmax - 1)
+			q = -qmax - 1;
+		acc -= q;
+
+		plan->coef[j] = (int)q;
+	}
+
+	plan->type = LOSSLESS_SUBFRAME_LPC;
+	plan->order = order;
+	plan->precision = LOSSLESS_PRECISION;
+	plan->shift = shift;
+
+	return 0;
+}
+
+static void lossless_subframe(struct WAVE_LOSSLESS_WORKER *worker, struct LOSSLESS_BITWRITER *bw,
+				const int *x, unsigned int n, unsigned int width)
+{
+	struct LOSSLESS_PLAN best;
+	struct LOSSLESS_PLAN plan;
+	int *residual = NULL;
+	unsigned int order = 0;
+	unsigned int i = 0;
+
+	for (i = 1; i < n; i++)
+	{
+		if (x[i] != x[0])
+			break;
+	}
+
+	if (i == n)
+	{
+		lossless_put(bw, LOSSLESS_SUBFRAME_CONSTANT, 8);
+		lossless_put(bw, x[0], width);
+		return;
+	}
+
+	best.type = LOSSLESS_SUBFRAME_VERBATIM;
+	best.bits = 8 + (unsigned long long)n * width;
+
+	for (order = 0; (order <= LOSSLESS_FIXED_ORDER) && (order < n); order++)
+	{
+		residual = worker->residual[0];
+
+		if (lossless_residual_fixed(x, n, order, residual) < 0)
+			continue;
+
+		plan.type = LOSSLESS_SUBFRAME_FIXED + order;
+		plan.order = order;
+		plan.bits = 8 + order * width + lossless_rice_plan(residual, n, order, &(plan.rice));
+
+		if (plan.bits < best.bits)
+		{
+			memcpy(&best, &plan, sizeof(struct LOSSLESS_PLAN));
+			worker->residual[0] = worker->residual[1];
+			worker->residual[1] = residual;
+		}
+	}
+
+	if (lossless_lpc_analyze(x, n, width, worker->window, &plan) == 0)
+	{
+		residual = worker->residual[0];
+
+		if (lossless_residual_lpc(x, n, plan.coef, plan.order, plan.shift, residual) == 0)
+		{
+			plan.bits = 8 + 4 + 5 + plan.order * (plan.precision + width) + \
+					lossless_rice_plan(residual, n, plan.order, &(plan.rice));
+
+			if (plan.bits < best.bits)
+			{
+				memcpy(&best, &plan, sizeof(struct LOSSLESS_PLAN));
+				worker->residual[0] = worker->residual[1];
+				worker->residual[1] = residual;
+			}
+		}
+	}
+
+	residual = worker->residual[1];
+
+	if (best.type == LOSSLESS_SUBFRAME_VERBATIM)
+	{
+		lossless_put(bw, LOSSLESS_SUBFRAME_VERBATIM, 8);
+		for (i = 0; i < n; i++)
+			lossless_put(bw, x[i], width);
+		return;
+	}
+
+	if (best.type == LOSSLESS_SUBFRAME_LPC)
+	{
+		lossless_put(bw, LOSSLESS_SUBFRAME_LPC + best.order - 1, 8);
+		lossless_put(bw, best.precision - 1, 4);
+		lossless_put(bw, best.shift, 5);
+		for (i = 0; i < best.order; i++)
+			lossless_put(bw, best.coef[i], best.precision);
+	}
+	else
+	{
+		lossless_put(bw, best.type, 8);
+	}
+
+	for (i = 0; i < best.order; i++)
+		lossless_put(bw, x[i], width);
+
+	lossless_rice_write(bw, residual, n, best.order, &(best.rice));
+}
+
+/* 按二阶预测残差的幅度和估算, 选择立体声去相关方式 */
+static unsigned int lossless_stereo(int *samples, unsigned int stride, unsigned int n)
+{
+	int *left  = samples;
+	int *right = samples + stride;
+	int *mid   = samples + 2 * stride;
+	int *side  = samples + 3 * stride;
+	unsigned long long sum[4] = {0, 0, 0, 0};
+	unsigned long long cost[4];
+	unsigned int mode = LOSSLESS_INDEPENDENT;
+	unsigned int i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		mid[i]  = (left[i] + right[i]) >> 1;
+		side[i] = left[i] - right[i];
+	}
+
+	for (i = 2; i < n; i++)
+	{
+		sum[0] += llabs(left[i] - 2LL * left[i - 1] + left[i - 2]);
+		sum[1] += llabs(right[i] - 2LL * right[i - 1] + right[i - 2]);
+		sum[2] += llabs(mid[i] - 2LL * mid[i - 1] + mid[i - 2]);
+		sum[3] += llabs(side[i] - 2LL * side[i - 1] + side[i - 2]);
+	}
+
+	cost[LOSSLESS_INDEPENDENT] = sum[0] + sum[1];
+	cost[LOSSLESS_LEFT_SIDE]   = sum[0] + sum[3];
+	cost[LOSSLESS_SIDE_RIGHT]  = sum[3] + sum[1];
+	cost[LOSSLESS_MID_SIDE]    = sum[2] + sum[3];
+
+	for (i = 1; i < 4; i++)
+	{
+		if (cost[i] < cost[mode])
+			mode = i;
+	}
+
+	return mode;
+}
+
+static int lossless_encode(struct WAVE_LOSSLESS *lossless, struct WAVE_LOSSLESS_WORKER *worker,
+				struct WAVE_LOSSLESS_JOB *job)
+{
+	struct LOSSLESS_FRAME header;
+	struct LOSSLESS_BITWRITER bw;
+	unsigned int stride = lossless->block;
+	unsigned int width = lossless->bits;
+	unsigned int mode = LOSSLESS_INDEPENDENT;
+	unsigned int plane[2] = {0, 1};
+	unsigned int extra[2] = {0, 0};
+	unsigned int c = 0;
+
+	lossless_pcm_unpack(job->pcm, job->frames, lossless->channels, lossless->bits,
+				worker->samples, stride);
+
+	/* side通道多一位, 32位采样不做去相关 */
+	if ((lossless->channels == 2) && (lossless->bits < 32) && (job->frames > 2))
+		mode = lossless_stereo(worker->samples, stride, job->frames);
+
+	switch (mode)
+	{
+	case LOSSLESS_LEFT_SIDE:
+		plane[1] = 3;
+		extra[1] = 1;
+		break;
+	case LOSSLESS_SIDE_RIGHT:
+		plane[0] = 3;
+		extra[0] = 1;
+		break;
+	case LOSSLESS_MID_SIDE:
+		plane[0] = 2;
+		plane[1] = 3;
+		extra[1] = 1;
+		break;
+	}
+
+	memset(&bw, 0, sizeof(struct LOSSLESS_BITWRITER));
+	bw.data = job->data + LOSSLESS_FRAME_SIZE;
+	bw.size = lossless->capacity - LOSSLESS_FRAME_SIZE;
+
+	for (c = 0; c < lossless->channels; c++)
+	{
+		if (c < 2)
+			lossless_subframe(worker, &bw, worker->samples + plane[c] * stride,
+						job->frames, width + extra[c]);
+		else
+			lossless_subframe(worker, &bw, worker->samples + c * stride,
+						job->frames, width);
+	}
+
+	lossless_put_align(&bw);
+
+	if (bw.overflow)
+	{
+		WAV_ERR("Frame overflow capacity[%u]", lossless->capacity);
+		return -EOVERFLOW;
+	}
+
+	/* 压缩帧在流中不保证对齐, 帧头整体拷贝 */
+	memcpy(header.sync, LOSSLESS_SYNC, 2);
+	header.mode = mode;
+	header.reserved = 0;
+	header.frames = job->frames;
+	header.reserved2 = 0;
+	header.size = LOSSLESS_FRAME_SIZE + bw.pos;
+	memcpy(job->data, &header, LOSSLESS_FRAME_SIZE);
+
+	job->size = header.size;
+
+	return 0;
+}
+
+static int lossless_subframe_decode(struct LOSSLESS_BITREADER *br, int *x, unsigned int n,
+				unsigned int width)
+{
+	int coef[LOSSLESS_MAX_ORDER];
+	unsigned int type = lossless_get(br, 8);
+	unsigned int order = 0;
+	unsigned int precision = 0;
+	unsigned int shift = 0;
+	unsigned int i = 0;
+	int retval = 0;
+
+	if (type == LOSSLESS_SUBFRAME_CONSTANT)
+	{
+		int value = lossless_get_signed(br, width);
+
+		for (i = 0; i < n; i++)
+			x[i] = value;
+
+		return br->error ? -EIO : 0;
+	}
+
+	if (type == LOSSLESS_SUBFRAME_VERBATIM)
+	{
+		for (i = 0; i < n; i++)
+			x[i] = lossless_get_signed(br, width);
+
+		return br->error ? -EIO : 0;
+	}
+
+	if ((type >= LOSSLESS_SUBFRAME_FIXED) && (type <= LOSSLESS_SUBFRAME_FIXED + LOSSLESS_FIXED_ORDER))
+	{
+		order = type - LOSSLESS_SUBFRAME_FIXED;
+	}
+	else if ((type >= LOSSLESS_SUBFRAME_LPC) && (type < LOSSLESS_SUBFRAME_LPC + LOSSLESS_MAX_ORDER))
+	{
+		order = type - LOSSLESS_SUBFRAME_LPC + 1;
+		precision = lossless_get(br, 4) + 1;
+		shift = lossless_get(br, 5);
+
+		for (i = 0; i < order; i++)
+			coef[i] = lossless_get_signed(br, precision);
+	}
+	else
+	{
+		return -EIO;
+	}
+
+	if (order > n)
+		return -EIO;
+
+	for (i = 0; i < order; i++)
+		x[i] = lossless_get_signed(br, width);
+
+	if (br->error)
+		return -EIO;
+
+	retval = lossless_rice_read(br, x, n, order);
+	if (retval < 0)
+		return retval;
+
+	/* 残差原地还原为采样 */
+	if (type < LOSSLESS_SUBFRAME_LPC)
+	{
+		for (i = order; i < n; i++)
+			x[i] = (int)(x[i] + lossless_fixed_predict(x, i, order));
+	}
+	else
+	{
+		for (i = order; i < n; i++)
+			x[i] = (int)(x[i] + lossless_lpc_predict(x, i, coef, order, shift));
+	}
+
+	return 0;
+}
+
+static int lossless_decode(struct WAVE_LOSSLESS *lossless, struct WAVE_LOSSLESS_WORKER *worker,
+				struct WAVE_LOSSLESS_JOB *job)
+{
+	struct LOSSLESS_FRAME header;
+	struct LOSSLESS_BITREADER br;
+	unsigned int stride = lossless->block;
+	unsigned int width = lossless->bits;
+	unsigned int n = job->frames;
+	int *a = worker->samples;
+	int *b = worker->samples + stride;
+	unsigned int c = 0;
+	unsigned int i = 0;
+	int retval = 0;
+
+	if (job->size < LOSSLESS_FRAME_SIZE)
+	{
+		WAV_ERR("Invalid frame size[%u]", job->size);
+		return -EIO;
+	}
+
+	memcpy(&header, job->data, LOSSLESS_FRAME_SIZE);
+
+	if (memcmp(header.sync, LOSSLESS_SYNC, 2) || (header.size != job->size) || (header.frames != n) ||
+		(header.mode > LOSSLESS_MID_SIDE) || (header.mode && (lossless->channels != 2)))
+	{
+		WAV_ERR("Invalid frame size[%u] frames[%u] mode[%u]", job->size, n, header.mode);
+		return -EIO;
+	}
+
+	memset(&br, 0, sizeof(struct LOSSLESS_BITREADER));
+	br.data = job->data + LOSSLESS_FRAME_SIZE;
+	br.size = job->size - LOSSLESS_FRAME_SIZE;
+
+	for (c = 0; c < lossless->channels; c++)
+	{
+		unsigned int extra = 0;
+
+		if ((c == 0) && (header.mode == LOSSLESS_SIDE_RIGHT))
+			extra = 1;
+		if ((c == 1) && ((header.mode == LOSSLESS_LEFT_SIDE) || (header.mode == LOSSLESS_MID_SIDE)))
+			extra = 1;
+
+		retval = lossless_subframe_decode(&br, worker->samples + c * stride, n, width + extra);
+		if (retval < 0)
+		{
+			WAV_ERR("Corrupted subframe of channel[%u]", c);
+			return retval;
+		}
+	}
+
+	switch (header.mode)
+	{
+	case LOSSLESS_LEFT_SIDE:
+		for (i = 0; i < n; i++)
+			b[i] = a[i] - b[i];
+		break;
+	case LOSSLESS_SIDE_RIGHT:
+		for (i = 0; i < n; i++)
+			a[i] = a[i] + b[i];
+		break;
+	case LOSSLESS_MID_SIDE:
+		for (i = 0; i < n; i++)
+		{
+			int side = b[i];
+			int mid = (int)(((unsigned int)a[i] << 1) | (side & 1));
+
+			a[i] = (mid + side) >> 1;
+			b[i] = (mid - side) >> 1;
+		}
+		break;
+	}
+
+	lossless_pcm_pack(job->pcm, n, lossless->channels, lossless->bits, worker->samples, stride);
+
+	return 0;
+}
+
+/************************************************************************************************************************/
+
+/* 工作线程从同一批任务中原子领取压缩帧, 帧之间互不依赖 */
+static void *lossless_worker(void *arg)
+{
+	struct WAVE_LOSSLESS_WORKER *worker = (struct WAVE_LOSSLESS_WORKER *)arg;
+	struct WAVE_LOSSLESS *lossless = worker->lossless;
+	unsigned int i = 0;
+
+	while ((i = __atomic_fetch_add(&lossless->jobNext, 1, __ATOMIC_RELAXED)) < lossless->jobCount)
+		lossless->jobs[i].error = lossless->work(lossless, worker, &(lossless->jobs[i]));
+
+	return NULL;
+}
+
+static int lossless_run(struct WAVE_LOSSLESS *lossless, unsigned int count,
+				int (*work)(struct WAVE_LOSSLESS *, struct WAVE_LOSSLESS_WORKER *, struct WAVE_LOSSLESS_JOB *))
+{
+	unsigned int threads = 0;
+	unsigned int i = 0;
+
+	lossless->work = work;
+	lossless->jobCount = count;
+	lossless->jobNext = 0;
+
+	threads = (count < lossless->threads) ? count : lossless->threads;
+
+	/* 调用线程自己也处理任务, 创建线程失败时由已有线程分担 */
+	for (i = 1; i < threads; i++)
+	{
+		if (pthread_create(&(lossless->workers[i].thread), NULL, lossless_worker, &(lossless->workers[i])))
+		{
+			WAV_WRN("pthread_create fail, %u workers", i);
+			break;
+		}
+	}
+	threads = i;
+
+	lossless_worker(&(lossless->workers[0]));
+
+	for (i = 1; i < threads; i++)
+		pthread_join(lossless->workers[i].thread, NULL);
+
+	for (i = 0; i < count; i++)
+	{
+		if (lossless->jobs[i].error < 0)
+			return lossless->jobs[i].error;
+	}
+
+	return 0;
+}
+
+static int lossless_seek_append(struct WAVE_LOSSLESS *lossless, unsigned int offset)
+{
+	unsigned int *seek = NULL;
+	unsigned int size = 0;
+
+	if (lossless->seekCount == lossless->seekSize)
+	{
+		size = lossless->seekSize ? (lossless->seekSize * 2) : 1024;
+
+		seek = (unsigned int *)realloc(lossless->seek, size * sizeof(unsigned int));
+		if (seek == NULL)
+		{
+			WAV_ERR("realloc(%u) fail", size);
+			return -ENOMEM;
+		}
+
+		lossless->seek = seek;
+		lossless->seekSize = size;
+	}
+
+	lossless->seek[lossless->seekCount++] = offset;
+
+	return 0;
+}
+
+static int lossless_encode_batch(struct WAVE *wave)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	struct iovec iov[CONFIG_LIBRARY_MINIWAVE_LOSSLESS_THREADS * 2];
+	unsigned int frames = lossless->used;
+	unsigned int count = (frames + lossless->block - 1) / lossless->block;
+	unsigned int size = 0;
+	unsigned int i = 0;
+	int retval = 0;
+
+	for (i = 0; i < count; i++)
+	{
+		struct WAVE_LOSSLESS_JOB *job = &(lossless->jobs[i]);
+
+		job->pcm = lossless->pcm + i * lossless->block * lossless->frame;
+		job->frames = frames - i * lossless->block;
+		if (job->frames > lossless->block)
+			job->frames = lossless->block;
+		job->data = lossless->stream + i * lossless->capacity;
+		job->size = 0;
+		job->error = 0;
+	}
+
+	retval = lossless_run(lossless, count, lossless_encode);
+	if (retval < 0)
+		return retval;
+
+	for (i = 0; i < count; i++)
+	{
+		retval = lossless_seek_append(lossless, wave->header.data.dataSize + size);
+		if (retval < 0)
+			return retval;
+
+		iov[i].iov_base = lossless->jobs[i].data;
+		iov[i].iov_len  = lossless->jobs[i].size;
+		size += lossless->jobs[i].size;
+	}
+
+	/* 一批压缩帧一次写入 */
+	retval = wave_data_writev(wave, iov, count);
+	if (retval < 0)
+	{
+		lossless->seekCount -= count;
+		return retval;
+	}
+
+	lossless->frames += frames;
+	lossless->used = 0;
+
+	return 0;
+}
+
+static int lossless_decode_batch(struct WAVE *wave)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	unsigned int dataSize = wave->header.data.dataSize;
+	unsigned int count = lossless->seekCount - lossless->next;
+	unsigned int start = 0;
+	unsigned int end = 0;
+	unsigned int length = 0;
+	unsigned int frames = 0;
+	unsigned int i = 0;
+	int retval = 0;
+
+	lossless->count = 0;
+	lossless->used = 0;
+
+	if (count == 0)
+		return 0;
+
+	if (count > lossless->batch)
+		count = lossless->batch;
+
+	start = lossless->seek[lossless->next];
+	end = (lossless->next + count < lossless->seekCount) ? \
+			lossless->seek[lossless->next + count] : dataSize;
+
+	for (length = 0; length < end - start; length += retval)
+	{
+		retval = wave_data_read(wave, lossless->stream + length, end - start - length);
+		if (retval <= 0)
+			break;
+	}
+
+	if ((retval < 0) && (length == 0))
+		return retval;
+
+	for (i = 0; i < count; i++)
+	{
+		struct WAVE_LOSSLESS_JOB *job = &(lossless->jobs[i]);
+		unsigned int index = lossless->next + i;
+		unsigned int offset = lossless->seek[index] - start;
+		unsigned int next = ((index + 1 < lossless->seekCount) ? lossless->seek[index + 1] : dataSize) - start;
+
+		/* 文件被截断时只解码完整的帧 */
+		if (next > length)
+			break;
+
+		job->pcm = lossless->pcm + frames * lossless->frame;
+		job->frames = lossless->sampleLength - index * lossless->block;
+		if (job->frames > lossless->block)
+			job->frames = lossless->block;
+		job->data = lossless->stream + offset;
+		job->size = next - offset;
+		job->error = 0;
+
+		frames += job->frames;
+	}
+
+	if (i == 0)
+	{
+		WAV_WRN("Truncated frame[%u]", lossless->next);
+		lossless->next = lossless->seekCount;
+		return 0;
+	}
+
+	count = i;
+
+	retval = lossless_run(lossless, count, lossless_decode);
+	if (retval < 0)
+		return retval;
+
+	lossless->next += count;
+	lossless->count = frames;
+
+	return frames;
+}
+
+/* 优先加载seek块, 缺失或不一致时顺序扫描帧头重建 */
+static int lossless_index(struct WAVE *wave, struct WAVE_EXTRA *extra)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	struct LOSSLESS_FRAME header;
+	struct DATA_CHUNK chunk;
+	unsigned int dataSize = wave->header.data.dataSize;
+	unsigned int count = 0;
+	unsigned int offset = 0;
+	unsigned int total = 0;
+	unsigned int i = 0;
+	off_t position = 0;
+
+	if (extra->hasFact)
+	{
+		count = (extra->sampleLength + lossless->block - 1) / lossless->block;
+		position = wave->dataOffset + dataSize + (dataSize & 1);
+
+		if ((pread(wave->file, &chunk, DATA_CHUNK_SIZE, position) == DATA_CHUNK_SIZE) &&
+			(memcmp(chunk.dataType, LOSSLESS_SEEK_TYPE, 4) == 0) &&
+			(chunk.dataSize == count * sizeof(unsigned int)))
+		{
+			lossless->seek = (unsigned int *)malloc(chunk.dataSize + sizeof(unsigned int));
+			if (lossless->seek == NULL)
+			{
+				WAV_ERR("malloc(%u) fail", chunk.dataSize);
+				return -ENOMEM;
+			}
+
+			lossless->seekSize = count + 1;
+
+			if (pread(wave->file, lossless->seek, chunk.dataSize, position + DATA_CHUNK_SIZE) == chunk.dataSize)
+			{
+				for (i = 0; i < count; i++)
+				{
+					unsigned int next = (i + 1 < count) ? lossless->seek[i + 1] : dataSize;
+
+					if ((next < lossless->seek[i] + LOSSLESS_FRAME_SIZE) ||
+						(next - lossless->seek[i] > lossless->capacity))
+						break;
+				}
+
+				if ((i == count) && ((count == 0) || (lossless->seek[0] == 0)))
+				{
+					lossless->seekCount = count;
+					lossless->sampleLength = extra->sampleLength;
+					return 0;
+				}
+			}
+
+			WAV_WRN("Invalid seek table, rebuild from frame headers");
+		}
+	}
+
+	lossless->seekCount = 0;
+
+	for (offset = 0; offset + LOSSLESS_FRAME_SIZE <= dataSize; offset += header.size)
+	{
+		if (pread(wave->file, &header, LOSSLESS_FRAME_SIZE, wave->dataOffset + offset) != LOSSLESS_FRAME_SIZE)
+			break;
+
+		if (memcmp(header.sync, LOSSLESS_SYNC, 2) || (header.size < LOSSLESS_FRAME_SIZE) ||
+			(header.size > lossless->capacity) || (header.size > dataSize - offset) ||
+			(header.frames == 0) || (header.frames > lossless->block))
+		{
+			WAV_WRN("Invalid frame header at %u", offset);
+			break;
+		}
+
+		if (lossless_seek_append(lossless, offset) < 0)
+			return -ENOMEM;
+
+		total += header.frames;
+
+		/* 只有最后一帧可以不满 */
+		if (header.frames < lossless->block)
+			break;
+	}
+
+	lossless->sampleLength = total;
+
+	return 0;
+}
+
+/************************************************************************************************************************/
+
+static int wave_lossless_read(struct WAVE *wave, void *buf, int len)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	unsigned int frames = len / lossless->frame;
+	unsigned int count = 0;
+	unsigned char *pcm = (unsigned char *)buf;
+	int retval = 0;
+
+	while (frames > 0)
+	{
+		if (lossless->used == lossless->count)
+		{
+			retval = lossless_decode_batch(wave);
+			if ((retval < 0) && (pcm == (unsigned char *)buf))
+				return retval;
+			if (retval <= 0)
+				break;
+		}
+
+		count = lossless->count - lossless->used;
+		if (count > frames)
+			count = frames;
+
+		memcpy(pcm, lossless->pcm + lossless->used * lossless->frame, count * lossless->frame);
+
+		lossless->used += count;
+		lossless->frames += count;
+		pcm += count * lossless->frame;
+		frames -= count;
+	}
+
+	return (int)(pcm - (unsigned char *)buf);
+}
+
+static int wave_lossless_write(struct WAVE *wave, const void *buf, int len)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	unsigned int frames = len / lossless->frame;
+	unsigned int count = 0;
+	const unsigned char *pcm = (const unsigned char *)buf;
+	int retval = 0;
+
+	while (frames > 0)
+	{
+		count = lossless->batch * lossless->block - lossless->used;
+		if (count > frames)
+			count = frames;
+
+		memcpy(lossless->pcm + lossless->used * lossless->frame, pcm, count * lossless->frame);
+
+		lossless->used += count;
+		pcm += count * lossless->frame;
+		frames -= count;
+
+		if (lossless->used == lossless->batch * lossless->block)
+		{
+			retval = lossless_encode_batch(wave);
+			if (retval < 0)
+				break;
+		}
+	}
+
+	/* 只收整帧, 返回实际收下的字节数 */
+	if ((retval < 0) && (pcm == (const unsigned char *)buf))
+		return retval;
+
+	return (int)(pcm - (const unsigned char *)buf);
+}
+
+static int wave_lossless_flush(struct WAVE *wave)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	int retval = 0;
+
+	if (lossless->used)
+	{
+		retval = lossless_encode_batch(wave);
+		if (retval < 0)
+			return retval;
+	}
+
+	/* seek块跟在data块之后, 不计入dataSize */
+	return wave_trailer_write(wave, LOSSLESS_SEEK_TYPE, lossless->seek,
+				lossless->seekCount * sizeof(unsigned int));
+}
+
+static int wave_lossless_seek(struct WAVE *wave, unsigned int frame)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	unsigned int index = 0;
+	unsigned int skip = 0;
+	off_t offset = 0;
+	int retval = 0;
+
+	if (frame > lossless->sampleLength)
+		frame = lossless->sampleLength;
+
+	index = frame / lossless->block;
+	if (index < lossless->seekCount)
+		offset = lossless->seek[index];
+	else
+		offset = wave->header.data.dataSize;
+
+	retval = wave_data_seek(wave, wave->dataOffset + offset);
+	if (retval < 0)
+		return retval;
+
+	lossless->next = (index < lossless->seekCount) ? index : lossless->seekCount;
+	lossless->frames = lossless->next * lossless->block;
+	lossless->count = 0;
+	lossless->used = 0;
+
+	skip = frame - lossless->frames;
+	if (skip)
+	{
+		retval = lossless_decode_batch(wave);
+		if (retval < 0)
+			return retval;
+
+		lossless->used = (skip < lossless->count) ? skip : lossless->count;
+		lossless->frames += lossless->used;
+	}
+
+	return 0;
+}
+
+static unsigned int wave_lossless_pack(struct WAVE *wave, void **image)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+
+	*image = &(lossless->header);
+
+	return wave_header_pack_ext(wave, &(lossless->header), lossless->block, lossless->frames);
+}
+
+static void wave_lossless_attr(struct WAVE *wave, WAV_ATTR *attr)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	unsigned int frames = lossless->frames;
+
+	if (wave->flags & WAVE_O_WRONLY)
+		frames += lossless->used;
+
+	attr->sampbits = lossless->bits;
+	attr->dataoffs = frames * lossless->frame;
+	attr->datasize = ((wave->flags & WAVE_O_WRONLY) ? frames : lossless->sampleLength) * lossless->frame;
+}
+
+static void wave_lossless_close(struct WAVE *wave)
+{
+	struct WAVE_LOSSLESS *lossless = wave->lossless;
+	unsigned int i = 0;
+
+	if (lossless == NULL)
+		return;
+
+	if (lossless->workers)
+	{
+		for (i = 0; i < lossless->threads; i++)
+		{
+			free(lossless->workers[i].samples);
+			free(lossless->workers[i].residual[0]);
+			free(lossless->workers[i].residual[1]);
+			free(lossless->workers[i].window);
+		}
+		free(lossless->workers);
+	}
+
+	free(lossless->jobs);
+	free(lossless->pcm);
+	free(lossless->stream);
+	free(lossless->seek);
+	free(lossless);
+
+	wave->lossless = NULL;
+	wave->codec = NULL;
+}
+
+static const struct WAVE_CODEC wave_lossless_codec =
+{
+	.read  = wave_lossless_read,
+	.write = wave_lossless_write,
+	.flush = wave_lossless_flush,
+	.seek  = wave_lossless_seek,
+	.pack  = wave_lossless_pack,
+	.attr  = wave_lossless_attr,
+	.close = wave_lossless_close,
+};
+
+int wave_lossless_open(struct WAVE *wave, WAV_ATTR *attr, struct WAVE_EXTRA *extra)
+{
+	struct FMTS_CHUNK *fmts = &(wave->header.fmts);
+	struct WAVE_LOSSLESS *lossless = NULL;
+	unsigned int channels = fmts->numChannels;
+	unsigned int bits = fmts->bitsPerSample;
+	unsigned int block = CONFIG_LIBRARY_MINIWAVE_LOSSLESS_BLOCK;
+	unsigned int planes = 0;
+	long online = 0;
+	unsigned int i = 0;
+	int retval = 0;
+
+	if ((channels == 0) || (channels > WAVE_LOSSLESS_CHANNELS) ||
+		((bits != 8) && (bits != 16) && (bits != 24) && (bits != 32)) ||
+		(fmts->blockAlign != channels * bits / 8))
+	{
+		WAV_ERR("Unsupported channels[%u] bitsPerSample[%u] blockAlign[%u]",
+			channels, bits, fmts->blockAlign);
+		return -EINVAL;
+	}
+
+	if (extra)
+		block = extra->samplesPerBlock;
+
+	if ((block < 2 * LOSSLESS_MAX_ORDER + 2) || (block > 0xFFFF))
+	{
+		WAV_ERR("Invalid samplesPerBlock[%u]", block);
+		return -EINVAL;
+	}
+
+	if (attr)
+	{
+		fmts->formatSize = FMTS_CHUNK_SIZE - 8 + 4;
+		fmts->compressionCode = WAVE_FORMAT_LOSSLESS;
+	}
+
+	lossless = (struct WAVE_LOSSLESS *)calloc(1, sizeof(struct WAVE_LOSSLESS));
+	if (lossless == NULL)
+	{
+		WAV_ERR("calloc(%lu) fail", sizeof(struct WAVE_LOSSLESS));
+		return -ENOMEM;
+	}
+
+	wave->lossless = lossless;
+
+	lossless->channels = channels;
+	lossless->bits = bits;
+	lossless->frame = channels * bits / 8;
+	lossless->block = block;
+
+	/* 最坏情况是每个子帧原样存储, side通道多一位 */
+	lossless->capacity = LOSSLESS_FRAME_SIZE + \
+			channels * ((8 + block * (bits + 1) + 7) / 8 + 1) + 8;
+
+	online = sysconf(_SC_NPROCESSORS_ONLN);
+	lossless->threads = CONFIG_LIBRARY_MINIWAVE_LOSSLESS_THREADS;
+	if ((online > 0) && (lossless->threads > online))
+		lossless->threads = online;
+	if (lossless->threads == 0)
+		lossless->threads = 1;
+	lossless->batch = lossless->threads * 2;
+
+	lossless->pcm = (unsigned char *)malloc((size_t)lossless->batch * block * lossless->frame);
+	lossless->stream = (unsigned char *)malloc((size_t)lossless->batch * lossless->capacity);
+	lossless->jobs = (struct WAVE_LOSSLESS_JOB *)calloc(lossless->batch, sizeof(struct WAVE_LOSSLESS_JOB));
+	lossless->workers = (struct WAVE_LOSSLESS_WORKER *)calloc(lossless->threads,
+					sizeof(struct WAVE_LOSSLESS_WORKER));
+	if (!lossless->pcm || !lossless->stream || !lossless->jobs || !lossless->workers)
+	{
+		WAV_ERR("malloc(%u) fail", lossless->batch * lossless->capacity);
+		retval = -ENOMEM;
+		goto ERR_EXIT;
+	}
+
+	planes = (channels > 2) ? channels : 4;
+
+	for (i = 0; i < lossless->threads; i++)
+	{
+		struct WAVE_LOSSLESS_WORKER *worker = &(lossless->workers[i]);
+
+		worker->lossless = lossless;
+		worker->samples = (int *)malloc((size_t)planes * block * sizeof(int));
+		worker->residual[0] = (int *)malloc(block * sizeof(int));
+		worker->residual[1] = (int *)malloc(block * sizeof(int));
+		worker->window = (double *)malloc(block * sizeof(double));
+		if (!worker->samples || !worker->residual[0] || !worker->residual[1] || !worker->window)
+		{
+			WAV_ERR("malloc(%u) fail", block);
+			retval = -ENOMEM;
+			goto ERR_EXIT;
+		}
+	}
+
+	if (extra)
+	{
+		retval = lossless_index(wave, extra);
+		if (retval < 0)
+			goto ERR_EXIT;
+	}
+
+	wave->codec = &wave_lossless_codec;
+
+	return 0;
+
+ERR_EXIT:
+	wave_lossless_close(wave);
+
+	return retval;
+}
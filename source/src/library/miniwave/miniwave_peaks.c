@@ -0,0 +1,673 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "miniwave.h"
+#include "miniwave_private.h"
+
+/************************************************************************************************************************/
+
+#define PEAK_MAGIC			"MWPK"
+#define PEAK_MAGIC_SIZE		strlen(PEAK_MAGIC)
+#define PEAK_VERSION		1
+#define PEAK_SUFFIX			".peak"
+
+#define PEAK_BATCH			256		// 每层攒够多少个bin写一次旁路文件
+#define PEAK_BLOCK			16384	// 每次读取的帧数, 和抽取倍数无关, bin可以跨越多次读取
+
+/* 旁路文件头部, 后面依次是各层的WAV_PEAK数组, 每个bin按通道交织 */
+struct PEAK_HEADER
+{
+	char magic[4];
+	unsigned int version;
+	unsigned long long size;	// 源文件长度
+	long long mtime;			// 源文件修改时间(ns)
+	unsigned int channels;
+	unsigned int frames;
+	unsigned int levels;
+	unsigned int decimation[WAVE_PEAKS_LEVELS];
+	unsigned int bins[WAVE_PEAKS_LEVELS];
+};
+
+struct PEAK_ACC
+{
+	int min;
+	int max;
+	unsigned long long sumsq;
+	unsigned int count;
+};
+
+struct PEAK_LEVEL
+{
+	struct PEAK_ACC *acc;		// 每通道累加器
+	WAV_PEAK *batch;			// 待写出的bin
+	unsigned int pending;		// batch中的bin个数
+	unsigned int written;		// 已写出的bin个数
+	off_t offset;				// 本层在旁路文件中的偏移
+};
+
+struct PEAKS
+{
+	int file;
+	struct PEAK_HEADER header;
+	off_t offset[WAVE_PEAKS_LEVELS];
+};
+
+static const unsigned int peak_decimation[] = {256, 4096, 65536};
+
+/************************************************************************************************************************/
+
+/*
+ * 采样统一转换为按通道分开的16bit数组, 后面的极值/平方和循环只处理连续int16,
+ * 编译器可以直接向量化, 不同平台不需要各自的intrinsics.
+ */
+static void peak_deinterleave(const unsigned char *src, short **dst,
+				unsigned int frames, unsigned int channels, unsigned int bytes)
+{
+	unsigned int i = 0;
+	unsigned int c = 0;
+
+	for (c = 0; c < channels; c++)
+	{
+		const unsigned char *s = src + c * bytes;
+		short *d = dst[c];
+		unsigned int stride = channels * bytes;
+
+		switch (bytes)
+		{
+		case 1:
+			for (i = 0; i < frames; i++)
+				d[i] = (short)(((int)s[i * stride] - 128) << 8);
+			break;
+		case 2:
+			for (i = 0; i < frames; i++)
+				d[i] = (short)(s[i * stride] | (s[i * stride + 1] << 8));
+			break;
+		case 3:
+			for (i = 0; i < frames; i++)
+				d[i] = (short)(s[i * stride + 1] | (s[i * stride + 2] << 8));
+			break;
+		case 4:
+			for (i = 0; i < frames; i++)
+				d[i] = (short)(s[i * stride + 2] | (s[i * stride + 3] << 8));
+			break;
+		}
+	}
+}
+
+static void peak_scan(const short *s, unsigned int n, struct PEAK_ACC *acc)
+{
+	int lo = acc->min;
+	int hi = acc->max;
+	unsigned long long sq = 0;
+	unsigned int i = 0;
+
+	for (i = 0; i < n; i++)
+	{
+		int v = s[i];
+
+		lo = (v < lo) ? v : lo;
+		hi = (v > hi) ? v : hi;
+		sq += (unsigned int)(v * v);
+	}
+
+	acc->min = lo;
+	acc->max = hi;
+	acc->sumsq += sq;
+	acc->count += n;
+}
+
+static void peak_acc_reset(struct PEAK_ACC *acc, unsigned int channels)
+{
+	unsigned int c = 0;
+
+	for (c = 0; c < channels; c++)
+	{
+		acc[c].min = 32767;
+		acc[c].max = -32768;
+		acc[c].sumsq = 0;
+		acc[c].count = 0;
+	}
+}
+
+static int peak_level_flush(struct PEAKS *peaks, struct PEAK_LEVEL *level)
+{
+	unsigned int channels = peaks->header.channels;
+	size_t size = level->pending * channels * sizeof(WAV_PEAK);
+	off_t offset = level->offset + (off_t)level->written * channels * sizeof(WAV_PEAK);
+	ssize_t retval = 0;
+
+	if (level->pending == 0)
+		return 0;
+
+	retval = pwrite(peaks->file, level->batch, size, offset);
+	if (retval != size)
+	{
+		WAV_ERR("pwrite(%d, %lu, %ld) fail[%d]",
+			peaks->file, (unsigned long)size, (long)offset, errno);
+		return (retval < 0) ? -errno : -EIO;
+	}
+
+	level->written += level->pending;
+	level->pending = 0;
+
+	return 0;
+}
+
+/* 输出第l层的一个bin, 并累加到上一层; 上一层满了继续向上级联 */
+static int peak_level_emit(struct PEAKS *peaks, struct PEAK_LEVEL *levels, unsigned int l)
+{
+	struct PEAK_HEADER *header = &(peaks->header);
+	unsigned int channels = header->channels;
+	struct PEAK_LEVEL *level = &levels[l];
+	WAV_PEAK *peak = NULL;
+	unsigned int c = 0;
+	int retval = 0;
+
+	peak = level->batch + level->pending * channels;
+
+	for (c = 0; c < channels; c++)
+	{
+		struct PEAK_ACC *acc = &(level->acc[c]);
+
+		peak[c].min = acc->min;
+		peak[c].max = acc->max;
+		peak[c].rms = acc->count ? (unsigned short)sqrt((double)acc->sumsq / acc->count) : 0;
+
+		if (l + 1 < header->levels)
+		{
+			struct PEAK_ACC *up = &(levels[l + 1].acc[c]);
+
+			up->min = (acc->min < up->min) ? acc->min : up->min;
+			up->max = (acc->max > up->max) ? acc->max : up->max;
+			up->sumsq += acc->sumsq;
+			up->count += acc->count;
+		}
+	}
+
+	peak_acc_reset(level->acc, channels);
+
+	if (++level->pending == PEAK_BATCH)
+	{
+		retval = peak_level_flush(peaks, level);
+		if (retval < 0)
+			return retval;
+	}
+
+	if ((l + 1 < header->levels) &&
+		(levels[l + 1].acc[0].count == header->decimation[l + 1]))
+		return peak_level_emit(peaks, levels, l + 1);
+
+	return 0;
+}
+
+/* 源文件比头部声明的短时各层bin变少, 把后面的层前移紧挨着存放 */
+static int peak_compact(struct PEAKS *peaks)
+{
+	struct PEAK_HEADER *header = &(peaks->header);
+	unsigned char buffer[PEAK_BATCH * sizeof(WAV_PEAK)];
+	off_t offset = sizeof(struct PEAK_HEADER);
+	off_t done = 0;
+	off_t size = 0;
+	ssize_t length = 0;
+	unsigned int l = 0;
+
+	for (l = 0; l < header->levels; l++)
+	{
+		size = (off_t)header->bins[l] * header->channels * sizeof(WAV_PEAK);
+
+		/* 目标在源之前, 从前往后搬不会覆盖未搬的数据 */
+		for (done = 0; (offset != peaks->offset[l]) && (done < size); done += length)
+		{
+			length = (size - done < sizeof(buffer)) ? (size - done) : sizeof(buffer);
+
+			if ((pread(peaks->file, buffer, length, peaks->offset[l] + done) != length) ||
+				(pwrite(peaks->file, buffer, length, offset + done) != length))
+			{
+				WAV_ERR("move level[%u] fail[%d]", l, errno);
+				return -EIO;
+			}
+		}
+
+		peaks->offset[l] = offset;
+		offset += size;
+	}
+
+	if (ftruncate(peaks->file, offset) < 0)
+	{
+		WAV_ERR("ftruncate(%d, %ld) fail[%d]", peaks->file, (long)offset, errno);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int peak_build(struct PEAKS *peaks, const char *name)
+{
+	struct PEAK_HEADER *header = &(peaks->header);
+	struct PEAK_LEVEL levels[WAVE_PEAKS_LEVELS];
+	unsigned int channels = header->channels;
+	unsigned int decim = header->decimation[0];
+	unsigned int block = PEAK_BLOCK;
+	unsigned int bytes = 0;
+	unsigned int frames = 0;
+	unsigned int n = 0;
+	unsigned char *buffer = NULL;
+	short *planar[64];
+	short *plane = NULL;
+	WAV_ATTR attr;
+	WAV wav = NULL;
+	unsigned int l = 0;
+	unsigned int c = 0;
+	unsigned int i = 0;
+	int truncated = 0;
+	int length = 0;
+	int retval = 0;
+
+	memset(levels, 0, sizeof(levels));
+
+	wav = miniwave_open(name, WAVE_O_RDONLY, &attr);
+	if (wav == NULL)
+		return -EPERM;
+
+	bytes = attr.sampbits / 8;
+
+	buffer = (unsigned char *)malloc(block * channels * bytes);
+	plane = (short *)malloc(block * channels * sizeof(short));
+	if ((buffer == NULL) || (plane == NULL))
+	{
+		WAV_ERR("malloc(%u) fail", block * channels * bytes);
+		retval = -ENOMEM;
+		goto ERR_EXIT;
+	}
+
+	for (c = 0; c < channels; c++)
+		planar[c] = plane + c * block;
+
+	for (l = 0; l < header->levels; l++)
+	{
+		levels[l].acc = (struct PEAK_ACC *)malloc(channels * sizeof(struct PEAK_ACC));
+		levels[l].batch = (WAV_PEAK *)malloc(PEAK_BATCH * channels * sizeof(WAV_PEAK));
+		if ((levels[l].acc == NULL) || (levels[l].batch == NULL))
+		{
+			WAV_ERR("malloc level[%u] fail", l);
+			retval = -ENOMEM;
+			goto ERR_EXIT;
+		}
+
+		peak_acc_reset(levels[l].acc, channels);
+		levels[l].offset = peaks->offset[l];
+	}
+
+	/* 有预读时读盘和统计重叠 */
+	miniwave_readahead(wav, 0, 0);
+
+	while (1)
+	{
+		length = 0;
+		while (length < block * channels * bytes)
+		{
+			retval = miniwave_read(wav, buffer + length, block * channels * bytes - length);
+			if (retval <= 0)
+				break;
+			length += retval;
+		}
+
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		frames = length / (channels * bytes);
+		if (frames == 0)
+			break;
+
+		peak_deinterleave(buffer, planar, frames, channels, bytes);
+
+		for (i = 0; i < frames; i += n)
+		{
+			n = decim - levels[0].acc[0].count;
+			if (n > frames - i)
+				n = frames - i;
+
+			for (c = 0; c < channels; c++)
+				peak_scan(planar[c] + i, n, &(levels[0].acc[c]));
+
+			if (levels[0].acc[0].count == decim)
+			{
+				retval = peak_level_emit(peaks, levels, 0);
+				if (retval < 0)
+					goto ERR_EXIT;
+			}
+		}
+
+		if (frames < block)
+			break;
+	}
+
+	/* 末尾不满一个bin的部分逐层补齐 */
+	for (l = 0, truncated = 0; l < header->levels; l++)
+	{
+		if (levels[l].acc[0].count)
+		{
+			retval = peak_level_emit(peaks, levels, l);
+			if (retval < 0)
+				goto ERR_EXIT;
+		}
+
+		retval = peak_level_flush(peaks, &levels[l]);
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		if (levels[l].written != header->bins[l])
+		{
+			WAV_WRN("level[%u] bins[%u] expect[%u], source truncated",
+				l, levels[l].written, header->bins[l]);
+			header->bins[l] = levels[l].written;
+			truncated = 1;
+		}
+	}
+
+	retval = truncated ? peak_compact(peaks) : 0;
+
+ERR_EXIT:
+	for (l = 0; l < header->levels; l++)
+	{
+		free(levels[l].acc);
+		free(levels[l].batch);
+	}
+
+	free(buffer);
+	free(plane);
+	miniwave_close(wav);
+
+	return retval;
+}
+
+/* 旁路文件可能被改写或损坏, 头部每个字段都要和源文件推算的一致, 长度和各层布局吻合 */
+static int peak_header_check(int file, struct PEAK_HEADER *cache, struct PEAK_HEADER *expect)
+{
+	struct stat st;
+	off_t offset = sizeof(struct PEAK_HEADER);
+	unsigned int l = 0;
+
+	if (memcmp(cache->magic, PEAK_MAGIC, PEAK_MAGIC_SIZE) ||
+		(cache->version != PEAK_VERSION) ||
+		(cache->size != expect->size) ||
+		(cache->mtime != expect->mtime) ||
+		(cache->channels != expect->channels) ||
+		(cache->frames != expect->frames) ||
+		(cache->levels != expect->levels))
+		return -ESTALE;
+
+	for (l = 0; l < cache->levels; l++)
+	{
+		if ((cache->decimation[l] != expect->decimation[l]) ||
+			(cache->bins[l] > expect->bins[l]) ||
+			(l && (cache->bins[l] > cache->bins[l - 1])))
+			return -ESTALE;
+
+		offset += (off_t)cache->bins[l] * cache->channels * sizeof(WAV_PEAK);
+	}
+
+	if ((fstat(file, &st) < 0) || (st.st_size != offset))
+		return -ESTALE;
+
+	return 0;
+}
+
+/************************************************************************************************************************/
+
+WAV_PEAKS miniwave_peaks_open(const char *name, const char *cache,
+				const unsigned int *decimation, int levels)
+{
+	struct PEAKS *peaks = NULL;
+	struct PEAK_HEADER *header = NULL;
+	struct PEAK_HEADER cached;
+	struct stat st;
+	WAV_ATTR attr;
+	WAV wav = NULL;
+	char *path = NULL;
+	char *temp = NULL;
+	off_t offset = 0;
+	int l = 0;
+	int retval = 0;
+
+	if (name == NULL)
+	{
+		WAV_ERR("Invalid name[%p]", name);
+		return (WAV_PEAKS)NULL;
+	}
+
+	if (decimation == NULL)
+	{
+		decimation = peak_decimation;
+		levels = sizeof(peak_decimation) / sizeof(peak_decimation[0]);
+	}
+
+	if ((levels <= 0) || (levels > WAVE_PEAKS_LEVELS))
+	{
+		WAV_ERR("Invalid levels[%d]", levels);
+		return (WAV_PEAKS)NULL;
+	}
+
+	/* 粗层由细层合并得到, 抽取倍数必须逐层整除 */
+	for (l = 0; l < levels; l++)
+	{
+		if ((decimation[l] == 0) || (l && (decimation[l] % decimation[l - 1] ||
+			decimation[l] == decimation[l - 1])))
+		{
+			WAV_ERR("Invalid decimation[%d] = %u", l, decimation[l]);
+			return (WAV_PEAKS)NULL;
+		}
+	}
+
+	if (stat(name, &st) < 0)
+	{
+		WAV_ERR("stat(%s) fail[%d]", name, errno);
+		return (WAV_PEAKS)NULL;
+	}
+
+	peaks = (struct PEAKS *)calloc(1, sizeof(struct PEAKS));
+	if (peaks == NULL)
+	{
+		WAV_ERR("calloc(%lu) fail", sizeof(struct PEAKS));
+		return (WAV_PEAKS)NULL;
+	}
+
+	peaks->file = -1;
+
+	path = (char *)malloc(strlen(cache ? cache : name) + strlen(PEAK_SUFFIX) + 1);
+	temp = (char *)malloc(strlen(cache ? cache : name) + strlen(PEAK_SUFFIX) + 8);
+	if ((path == NULL) || (temp == NULL))
+	{
+		WAV_ERR("malloc fail");
+		goto ERR_EXIT;
+	}
+
+	if (cache)
+		strcpy(path, cache);
+	else
+		sprintf(path, "%s" PEAK_SUFFIX, name);
+
+	header = &(peaks->header);
+	memcpy(header->magic, PEAK_MAGIC, PEAK_MAGIC_SIZE);
+	header->version = PEAK_VERSION;
+	header->size = st.st_size;
+	header->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	header->levels = levels;
+	for (l = 0; l < levels; l++)
+		header->decimation[l] = decimation[l];
+
+	wav = miniwave_open(name, WAVE_O_RDONLY, &attr);
+	if (wav == NULL)
+		goto ERR_EXIT;
+	miniwave_close(wav);
+
+	if ((attr.channels == 0) || (attr.channels > 64) ||
+		(attr.sampbits == 0) || (attr.sampbits > 32) || (attr.sampbits % 8))
+	{
+		WAV_ERR("Unsupported channels[%u] sampbits[%u]", attr.channels, attr.sampbits);
+		goto ERR_EXIT;
+	}
+
+	header->channels = attr.channels;
+	header->frames = attr.datasize / (attr.channels * attr.sampbits / 8);
+	for (l = 0; l < levels; l++)
+		header->bins[l] = header->frames / decimation[l] + !!(header->frames % decimation[l]);
+
+	/* 旁路文件和源文件长度/修改时间一致才复用 */
+	peaks->file = open(path, O_RDONLY);
+	if (peaks->file >= 0)
+	{
+		retval = pread(peaks->file, &cached, sizeof(cached), 0);
+		if ((retval == sizeof(cached)) && (peak_header_check(peaks->file, &cached, header) == 0))
+		{
+			memcpy(header, &cached, sizeof(cached));
+			goto DONE;
+		}
+
+		close(peaks->file);
+		peaks->file = -1;
+	}
+
+	/* 临时文件名唯一, 并发生成同一个旁路文件时互不覆盖 */
+	sprintf(temp, "%s.XXXXXX", path);
+
+	peaks->file = mkstemp(temp);
+	if (peaks->file < 0)
+	{
+		WAV_ERR("mkstemp(%s) fail[%d]", temp, errno);
+		goto ERR_EXIT;
+	}
+
+	if (fchmod(peaks->file, 0644) < 0)
+		WAV_WRN("fchmod(%s) fail[%d]", temp, errno);
+
+	offset = sizeof(struct PEAK_HEADER);
+	for (l = 0; l < levels; l++)
+	{
+		peaks->offset[l] = offset;
+		offset += (off_t)header->bins[l] * header->channels * sizeof(WAV_PEAK);
+	}
+
+	retval = peak_build(peaks, name);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	retval = pwrite(peaks->file, header, sizeof(struct PEAK_HEADER), 0);
+	if (retval != sizeof(struct PEAK_HEADER))
+	{
+		WAV_ERR("pwrite(%d, header) fail[%d]", peaks->file, errno);
+		goto ERR_EXIT;
+	}
+
+	if (rename(temp, path) < 0)
+	{
+		WAV_ERR("rename(%s, %s) fail[%d]", temp, path, errno);
+		goto ERR_EXIT;
+	}
+
+DONE:
+	offset = sizeof(struct PEAK_HEADER);
+	for (l = 0; l < header->levels; l++)
+	{
+		peaks->offset[l] = offset;
+		offset += (off_t)header->bins[l] * header->channels * sizeof(WAV_PEAK);
+	}
+
+	free(path);
+	free(temp);
+
+	return (WAV_PEAKS)peaks;
+
+ERR_EXIT:
+	if (peaks->file >= 0)
+	{
+		close(peaks->file);
+		unlink(temp);
+	}
+
+	free(peaks);
+	free(path);
+	free(temp);
+
+	return (WAV_PEAKS)NULL;
+}
+
+int miniwave_peaks_info(WAV_PEAKS handle, int level, unsigned int *decimation, unsigned int *bins)
+{
+	struct PEAKS *peaks = (struct PEAKS *)handle;
+
+	if ((handle == NULL) || (level < 0) || (level >= peaks->header.levels))
+	{
+		WAV_ERR("Invalid peaks[%p] level[%d]", handle, level);
+		return -EINVAL;
+	}
+
+	if (decimation)
+		*decimation = peaks->header.decimation[level];
+	if (bins)
+		*bins = peaks->header.bins[level];
+
+	return peaks->header.channels;
+}
+
+int miniwave_peaks_read(WAV_PEAKS handle, int level, unsigned int bin, unsigned int count, WAV_PEAK *buf)
+{
+	struct PEAKS *peaks = (struct PEAKS *)handle;
+	unsigned int channels = 0;
+	size_t size = 0;
+	ssize_t retval = 0;
+
+	if ((handle == NULL) || (buf == NULL) || (level < 0) || (level >= peaks->header.levels))
+	{
+		WAV_ERR("Invalid peaks[%p] level[%d] buf[%p]", handle, level, buf);
+		return -EINVAL;
+	}
+
+	if (bin >= peaks->header.bins[level])
+		return 0;
+
+	if (count > peaks->header.bins[level] - bin)
+		count = peaks->header.bins[level] - bin;
+
+	channels = peaks->header.channels;
+	size = (size_t)count * channels * sizeof(WAV_PEAK);
+
+	retval = pread(peaks->file, buf, size,
+			peaks->offset[level] + (off_t)bin * channels * sizeof(WAV_PEAK));
+	if (retval < 0)
+	{
+		WAV_ERR("pread(%d, %lu) fail[%d]", peaks->file, (unsigned long)size, errno);
+		return -errno;
+	}
+
+	return retval / (channels * sizeof(WAV_PEAK));
+}
+
+int miniwave_peaks_close(WAV_PEAKS handle)
+{
+	struct PEAKS *peaks = (struct PEAKS *)handle;
+
+	if (handle == NULL)
+	{
+		WAV_ERR("Invalid peaks[%p]", handle);
+		return -EINVAL;
+	}
+
+	close(peaks->file);
+	free(peaks);
+
+	return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __MINIWAVE_PRIVATE_H__
+#define __MINIWAVE_PRIVATE_H__
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "miniwave.h"
+
+#define WAV_ERR(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
+#define WAV_WRN(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
+#define WAV_INF(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
+#define WAV_DBG(fmt, args...)	printf("[%s|%d]:" fmt "\r\n", __func__, __LINE__, ##args)
+
+/************************************************************************************************************************/
+
+struct RIFF_CHUNK
+{
+	char            riffType[4];    //4byte,资源交换文件标志:RIFF
+    unsigned int    riffSize;       //4byte,从下个地址到文件结尾的总字节数
+    char            waveType[4];    //4byte,wave文件标志:WAVE
+};
+
+struct FMTS_CHUNK
+{
+	char            formatType[4];  //4byte,波形文件标志:FMT
+    unsigned int    formatSize;     //4byte,音频属性(compressionCode,numChannels,sampleRate,bytesPerSecond,blockAlign,bitsPerSample)所占字节数
+    unsigned short  compressionCode;//2byte,编码格式(1-线性pcm-WAVE_FORMAT_PCM,WAVEFORMAT_ADPCM)
+    unsigned short  numChannels;    //2byte,通道数
+    unsigned int    sampleRate;     //4byte,采样率
+    unsigned int    bytesPerSecond; //4byte,传输速率
+    unsigned short  blockAlign;     //2byte,数据块的对齐
+    unsigned short  bitsPerSample;  //2byte,采样精度
+};
+
+struct FACT_CHUNK
+{
+	char			factType[4];	// 4byte,
+	unsigned int	factSize;
+};
+
+struct DATA_CHUNK
+{
+	char            dataType[4];    //4byte,数据标志:data
+    unsigned int    dataSize;       //4byte,从下个地址到文件结尾的总字节数，即除了wav header以外的pcm data length
+};
+
+struct WAVE_HEADER
+{
+	struct RIFF_CHUNK	riff;
+	struct FMTS_CHUNK	fmts;
+	union {
+		struct FACT_CHUNK fact;
+		struct DATA_CHUNK data;
+	};
+};
+
+#define RIFF_TYPE		"RIFF"
+#define RIFF_TYPE_SIZE	strlen(RIFF_TYPE)
+#define WAVE_TYPE		"WAVE"
+#define WAVE_TYPE_SIZE	strlen(WAVE_TYPE)
+#define FMTS_TYPE		"fmt "
+#define FMTS_TYPE_SIZE	strlen(FMTS_TYPE)
+#define FACT_TYPE		"fact"
+#define FACT_TYPE_SIZE	strlen(FACT_TYPE)
+#define DATA_TYPE		"data"
+#define DATA_TYPE_SIZE	strlen(DATA_TYPE)
+
+#define RIFF_CHUNK_SIZE	sizeof(struct RIFF_CHUNK)
+#define FMTS_CHUNK_SIZE	sizeof(struct FMTS_CHUNK)
+#define FACT_CHUNK_SIZE	sizeof(struct FACT_CHUNK)
+#define DATA_CHUNK_SIZE	sizeof(struct DATA_CHUNK)
+
+#define WAVE_FORMAT_PCM			0x0001
+#define WAVE_FORMAT_IMA_ADPCM	0x0011
+#define WAVE_FORMAT_LOSSLESS	0x4D4C	// 本库私有的无损压缩格式
+
+/* 解析头部时附带的扩展信息 */
+struct WAVE_EXTRA
+{
+	unsigned short cbSize;			// fmt扩展字节数
+	unsigned short samplesPerBlock;	// 压缩格式每块采样数
+	unsigned int sampleLength;		// fact块: 每通道采样总数
+	int hasFact;
+};
+
+/* 压缩格式写入时的头部布局: 扩展fmt + fact */
+struct WAVE_HEADER_EXT
+{
+	struct RIFF_CHUNK	riff;
+	struct FMTS_CHUNK	fmts;
+	unsigned short		cbSize;
+	unsigned short		samplesPerBlock;
+	struct FACT_CHUNK	fact;
+	unsigned int		sampleLength;
+	struct DATA_CHUNK	data;
+};
+
+#define WAVE_ADPCM_CHANNELS	16
+
+struct WAVE;
+
+/* 压缩格式编解码接口, 对调用者收发的始终是PCM */
+struct WAVE_CODEC
+{
+	int (*read)(struct WAVE *wave, void *buf, int len);
+	int (*write)(struct WAVE *wave, const void *buf, int len);
+	int (*flush)(struct WAVE *wave);
+	int (*seek)(struct WAVE *wave, unsigned int frame);
+	unsigned int (*pack)(struct WAVE *wave, void **image);
+	void (*attr)(struct WAVE *wave, WAV_ATTR *attr);
+	void (*close)(struct WAVE *wave);
+};
+
+struct WAVE_ADPCM
+{
+	struct WAVE_HEADER_EXT header;
+	unsigned int channels;
+	unsigned int blockAlign;		// 每块字节数
+	unsigned int samplesPerBlock;	// 每块每通道采样数
+	unsigned int sampleLength;		// 读: 总帧数
+	unsigned int frames;			// 已解码/已编码帧数
+	unsigned char *block;			// 编码块缓冲区
+	short *pcm;						// 一块对应的PCM16
+	unsigned int count;				// pcm中的有效帧数
+	unsigned int used;				// pcm中已消费/已填充帧数
+	int index[WAVE_ADPCM_CHANNELS];	// 编码器步长索引, 跨块延续
+};
+
+#define WAVE_LOSSLESS_CHANNELS	8
+
+struct WAVE_LOSSLESS;
+
+struct WAVE_LOSSLESS_JOB
+{
+	unsigned char *pcm;		// 对应的PCM
+	unsigned int frames;	// PCM帧数
+	unsigned char *data;	// 压缩数据
+	unsigned int size;		// 压缩数据字节数
+	int error;
+};
+
+struct WAVE_LOSSLESS_WORKER
+{
+	pthread_t thread;
+	struct WAVE_LOSSLESS *lossless;
+	int *samples;			// 各通道平面采样, 立体声额外两路mid/side
+	int *residual[2];		// 候选残差和当前最优残差
+	double *window;			// 加窗后的采样, LPC分析用
+};
+
+struct WAVE_LOSSLESS
+{
+	struct WAVE_HEADER_EXT header;
+	unsigned int channels;
+	unsigned int bits;				// PCM采样位数
+	unsigned int frame;				// PCM每帧字节数
+	unsigned int block;				// 每个压缩帧的PCM帧数
+	unsigned int capacity;			// 单个压缩帧字节数上限
+	unsigned int sampleLength;		// 读: 总帧数
+	unsigned int frames;			// 已解码/已编码帧数
+	unsigned char *pcm;				// 一批压缩帧对应的PCM
+	unsigned int count;				// pcm中的有效帧数
+	unsigned int used;				// pcm中已消费/已填充帧数
+	unsigned char *stream;			// 一批压缩数据
+	unsigned int batch;				// 一批并行处理的压缩帧数
+	unsigned int threads;
+	struct WAVE_LOSSLESS_WORKER *workers;
+	struct WAVE_LOSSLESS_JOB *jobs;
+	unsigned int jobCount;
+	unsigned int jobNext;			// 工作线程原子领取
+	int (*work)(struct WAVE_LOSSLESS *lossless, struct WAVE_LOSSLESS_WORKER *worker,
+				struct WAVE_LOSSLESS_JOB *job);
+	unsigned int *seek;				// 各压缩帧相对data块的偏移
+	unsigned int seekCount;
+	unsigned int seekSize;
+	unsigned int next;				// 读: 下一个待解码的压缩帧
+};
+
+/* XXH64流式状态 */
+struct WAVE_XXH64
+{
+	unsigned long long acc[4];
+	unsigned long long total;
+	unsigned long long seed;
+	unsigned char mem[32];
+	unsigned int memsize;
+};
+
+/* 两层哈希树: 按leaf字节切分payload逐段XXH64, 根为各段摘要加总长的XXH64 */
+struct WAVE_HASH
+{
+	struct WAVE_XXH64 state;		// 当前段
+	unsigned int leaf;				// 每段字节数
+	unsigned int length;			// 当前段已累计字节数
+	unsigned long long bytes;		// payload总字节数
+	unsigned long long *leaves;		// 已完成各段的摘要
+	unsigned int count;
+	unsigned int capacity;
+	int broken;						// 中途seek过, 结果不代表完整payload
+};
+
+struct WAVE_DIO
+{
+	unsigned char *buffer;	// 当前填充的对齐缓冲区
+	unsigned int length;	// 缓冲区已填充字节数
+	off_t offset;			// 缓冲区对应的文件偏移
+	unsigned char *block;	// 文件首个对齐块副本, 关闭时回写头部
+	int fflags;				// 设置O_DIRECT前的文件状态标志
+};
+
+struct WAVE_RA
+{
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int file;
+	unsigned char **buffers;
+	unsigned int *lengths;
+	unsigned int depth;		// 缓冲区个数
+	unsigned int size;		// 单个缓冲区字节数
+	unsigned int head;		// 读者当前消费的缓冲区
+	unsigned int tail;		// 后台线程下一个填充的缓冲区
+	unsigned int count;		// 已填充未消费的缓冲区个数
+	unsigned int used;		// head缓冲区已消费字节数
+	off_t offset;			// 后台线程下一次读取的文件偏移
+	off_t position;			// 读者当前文件偏移
+	off_t end;				// 数据块结束偏移
+	int error;
+	int stop;
+};
+
+struct WAVE_CAP
+{
+	pthread_t thread;
+	struct WAVE *wave;
+	unsigned char *buffer;
+	unsigned int size;		// 环形缓冲区字节数, 帧对齐且预留一帧区分空满
+	unsigned int frame;		// 每帧字节数
+	unsigned int batch;		// 写盘批量字节数
+	unsigned int period;	// 写盘线程轮询间隔(us)
+	unsigned int head;		// 生产者写位置, 仅回调线程修改
+	unsigned int tail;		// 消费者读位置, 仅写盘线程修改
+	int stop;
+	WAV_CAPTURE_STAT stat;
+};
+
+struct WAVE
+{
+	int file;
+	unsigned int flags;
+	struct WAVE_HEADER header;
+	unsigned int dataOffset;
+	unsigned int prealloc;
+	struct WAVE_DIO dio;
+	struct WAVE_RA *ra;
+	struct WAVE_CAP *cap;
+	WAV_CAPTURE_STAT capstat;		// 最近一次录音停止时的统计
+	const struct WAVE_CODEC *codec;	// 压缩格式, PCM为NULL
+	struct WAVE_ADPCM *adpcm;
+	struct WAVE_LOSSLESS *lossless;
+	unsigned int trailer;			// data块之后附加块的字节数
+	struct WAVE_HASH *hash;			// WAVE_O_HASH: 读写时同步计算PCM哈希
+};
+
+#define WAVE_O_INTERNAL  (1 << 31)
+#define WAVE_O_HEADER    (1 << 30)	// 头部未落盘, 随首块数据一次写入
+
+#define WAVE_IOV_HEAD	16
+#define WAVE_IOV_STAGE	65536	// 压缩格式收发不整帧的iovec时的中转缓冲区字节数
+
+#ifndef CONFIG_LIBRARY_MINIWAVE_DIRECT_BUFSIZE
+#define CONFIG_LIBRARY_MINIWAVE_DIRECT_BUFSIZE	1048576
+#endif
+
+#ifndef CONFIG_LIBRARY_MINIWAVE_DIRECT_POOL
+#define CONFIG_LIBRARY_MINIWAVE_DIRECT_POOL		8
+#endif
+
+#ifndef CONFIG_LIBRARY_MINIWAVE_READAHEAD_DEPTH
+#define CONFIG_LIBRARY_MINIWAVE_READAHEAD_DEPTH	2
+#endif
+
+#ifndef CONFIG_LIBRARY_MINIWAVE_READAHEAD_SIZE
+#define CONFIG_LIBRARY_MINIWAVE_READAHEAD_SIZE	262144
+#endif
+
+#ifndef CONFIG_LIBRARY_MINIWAVE_LOSSLESS_BLOCK
+#define CONFIG_LIBRARY_MINIWAVE_LOSSLESS_BLOCK	4096
+#endif
+
+#ifndef CONFIG_LIBRARY_MINIWAVE_LOSSLESS_THREADS
+#define CONFIG_LIBRARY_MINIWAVE_LOSSLESS_THREADS	4
+#endif
+
+#ifndef CONFIG_LIBRARY_MINIWAVE_HASH_THREADS
+#define CONFIG_LIBRARY_MINIWAVE_HASH_THREADS	4
+#endif
+
+#define WAVE_DIO_ALIGN		4096
+#define WAVE_DIO_BUFSIZE	((CONFIG_LIBRARY_MINIWAVE_DIRECT_BUFSIZE + WAVE_DIO_ALIGN - 1) & ~(WAVE_DIO_ALIGN - 1))
+#define WAVE_DIO_POOL		CONFIG_LIBRARY_MINIWAVE_DIRECT_POOL
+
+/************************************************************************************************************************/
+
+int wave_header_read(int file, struct WAVE_HEADER *header, struct WAVE_EXTRA *extra);
+
+int wave_header_write(int file, const void *header, unsigned int size);
+
+unsigned int wave_header_pack_ext(struct WAVE *wave, struct WAVE_HEADER_EXT *ext,
+				unsigned int samplesPerBlock, unsigned int sampleLength);
+
+int wave_data_read(struct WAVE *wave, void *buf, int len);
+
+int wave_data_seek(struct WAVE *wave, off_t offset);
+
+int wave_data_write(struct WAVE *wave, const void *buf, int len);
+
+int wave_data_writev(struct WAVE *wave, const struct iovec *iov, int iovcnt);
+
+int wave_trailer_write(struct WAVE *wave, const char *type, const void *payload, unsigned int size);
+
+off_t wave_trailer_find(int file, off_t offset, const char *type, unsigned int *size);
+
+int wave_adpcm_open(struct WAVE *wave, WAV_ATTR *attr, struct WAVE_EXTRA *extra);
+
+int wave_lossless_open(struct WAVE *wave, WAV_ATTR *attr, struct WAVE_EXTRA *extra);
+
+struct WAVE_HASH *wave_hash_open(unsigned int leaf);
+
+void wave_hash_update(struct WAVE_HASH *hash, const void *buf, unsigned int len);
+
+void wave_hash_updatev(struct WAVE_HASH *hash, const struct iovec *iov, int iovcnt, unsigned int len);
+
+void wave_hash_reset(struct WAVE_HASH *hash, int broken);
+
+int wave_hash_flush(struct WAVE *wave);
+int wave_hash_refresh(const char *name);
+
+void wave_hash_close(struct WAVE_HASH *hash);
+
+int wave_silence_scan(WAV wav, double threshold, unsigned int minimum, WAV_REGION **regions);
+
+#endif
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "miniwave.h"
+#include "miniwave_private.h"
+
+/************************************************************************************************************************/
+
+#define SILENCE_WINDOW_MS	10			// 判决粒度
+#define SILENCE_BLOCK_SIZE	(256 * 1024)	// 每次读取的字节数, 按整窗取整
+#define SILENCE_NONE		0xFFFFFFFFU
+
+struct SILENCE_SCAN
+{
+	WAV_REGION *regions;
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int active;		// 当前有声区间起点
+	unsigned int silence;		// 当前静音段起点, SILENCE_NONE表示不在静音段
+	unsigned int minimum;		// 最短静音帧数
+};
+
+/************************************************************************************************************************/
+
+/*
+ * 交织数据不需要拆通道, 一个窗口内所有通道的采样直接求绝对值最大值;
+ * 循环只做连续数组的min/max, 编译器可以直接向量化.
+ */
+static unsigned int silence_absmax(const unsigned char *s, unsigned int n, unsigned int bytes)
+{
+	int lo = 0;
+	int hi = 0;
+	unsigned int i = 0;
+
+	switch (bytes)
+	{
+	case 1:
+		for (i = 0; i < n; i++)
+		{
+			int v = (int)s[i] - 128;
+
+			lo = (v < lo) ? v : lo;
+			hi = (v > hi) ? v : hi;
+		}
+		break;
+	case 2:
+		{
+			const short *p = (const short *)s;
+
+			for (i = 0; i < n; i++)
+			{
+				lo = (p[i] < lo) ? p[i] : lo;
+				hi = (p[i] > hi) ? p[i] : hi;
+			}
+		}
+		break;
+	case 3:
+		for (i = 0; i < n; i++)
+		{
+			int v = (int)((s[3 * i] << 8) | (s[3 * i + 1] << 16) | ((unsigned int)s[3 * i + 2] << 24)) >> 8;
+
+			lo = (v < lo) ? v : lo;
+			hi = (v > hi) ? v : hi;
+		}
+		break;
+	case 4:
+		{
+			const int *p = (const int *)s;
+
+			for (i = 0; i < n; i++)
+			{
+				lo = (p[i] < lo) ? p[i] : lo;
+				hi = (p[i] > hi) ? p[i] : hi;
+			}
+		}
+		break;
+	}
+
+	return ((unsigned int)hi > -(unsigned int)lo) ? (unsigned int)hi : -(unsigned int)lo;
+}
+
+static int silence_emit(struct SILENCE_SCAN *scan, unsigned int start, unsigned int end)
+{
+	if (end <= start)
+		return 0;
+
+	if (scan->count == scan->capacity)
+	{
+		unsigned int capacity = scan->capacity ? scan->capacity * 2 : 64;
+		WAV_REGION *regions = (WAV_REGION *)realloc(scan->regions, capacity * sizeof(WAV_REGION));
+
+		if (regions == NULL)
+		{
+			WAV_ERR("realloc(%u) fail", capacity);
+			return -ENOMEM;
+		}
+
+		scan->regions = regions;
+		scan->capacity = capacity;
+	}
+
+	scan->regions[scan->count].start = start;
+	scan->regions[scan->count].frames = end - start;
+	scan->count++;
+
+	return 0;
+}
+
+/* 一个窗口的判决结果, 静音段在遇到有声窗口时才知道长度够不够 */
+static int silence_step(struct SILENCE_SCAN *scan, unsigned int frame, int silent)
+{
+	int retval = 0;
+
+	if (silent)
+	{
+		if (scan->silence == SILENCE_NONE)
+			scan->silence = frame;
+		return 0;
+	}
+
+	if (scan->silence == SILENCE_NONE)
+		return 0;
+
+	if (frame - scan->silence >= scan->minimum)
+	{
+		retval = silence_emit(scan, scan->active, scan->silence);
+		scan->active = frame;
+	}
+
+	scan->silence = SILENCE_NONE;
+
+	return retval;
+}
+
+/************************************************************************************************************************/
+
+int wave_silence_scan(WAV wav, double threshold, unsigned int minimum, WAV_REGION **regions)
+{
+	struct SILENCE_SCAN scan;
+	WAV_ATTR attr;
+	unsigned char *buffer = NULL;
+	unsigned int window = 0;
+	unsigned int frame = 0;
+	unsigned int block = 0;
+	unsigned int level = 0;
+	unsigned int total = 0;
+	unsigned int frames = 0;
+	unsigned int i = 0;
+	int length = 0;
+	int retval = 0;
+
+	memset(&scan, 0, sizeof(scan));
+	*regions = NULL;
+
+	retval = miniwave_attr(wav, &attr);
+	if (retval < 0)
+		return retval;
+
+	if ((attr.samprate == 0) || (attr.channels == 0) ||
+		(attr.sampbits == 0) || (attr.sampbits > 32) || (attr.sampbits % 8))
+	{
+		WAV_ERR("Unsupported samprate[%u] channels[%u] sampbits[%u]",
+			attr.samprate, attr.channels, attr.sampbits);
+		return -EPERM;
+	}
+
+	/* 门限换算成整数幅度, 逐窗只比较整数 */
+	if (threshold > 0)
+		threshold = 0;
+
+	level = (unsigned int)(ldexp(pow(10.0, threshold / 20.0), attr.sampbits - 1));
+
+	frame = attr.channels * attr.sampbits / 8;
+	window = attr.samprate * SILENCE_WINDOW_MS / 1000;
+	if (window == 0)
+		window = 1;
+
+	block = SILENCE_BLOCK_SIZE / (window * frame) * window;
+	if (block == 0)
+		block = window;
+
+	scan.silence = SILENCE_NONE;
+	scan.minimum = (unsigned int)((unsigned long long)attr.samprate * minimum / 1000);
+
+	buffer = (unsigned char *)malloc(block * frame);
+	if (buffer == NULL)
+	{
+		WAV_ERR("malloc(%u) fail", block * frame);
+		return -ENOMEM;
+	}
+
+	retval = miniwave_seek(wav, 0);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	while (1)
+	{
+		length = 0;
+		while (length < block * frame)
+		{
+			retval = miniwave_read(wav, buffer + length, block * frame - length);
+			if (retval <= 0)
+				break;
+			length += retval;
+		}
+
+		if (retval < 0)
+			goto ERR_EXIT;
+
+		frames = length / frame;
+
+		for (i = 0; i < frames; i += window)
+		{
+			unsigned int n = (frames - i < window) ? (frames - i) : window;
+
+			retval = silence_step(&scan, total + i,
+						silence_absmax(buffer + i * frame, n * attr.channels, attr.sampbits / 8) <= level);
+			if (retval < 0)
+				goto ERR_EXIT;
+		}
+
+		total += frames;
+
+		if (frames < block)
+			break;
+	}
+
+	/* 结尾的静音段: 够长就截掉, 否则并入最后一个有声区间 */
+	if ((scan.silence != SILENCE_NONE) && (total - scan.silence >= scan.minimum))
+		retval = silence_emit(&scan, scan.active, scan.silence);
+	else
+		retval = silence_emit(&scan, scan.active, total);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	/* 扫描完回到开头, 调用者按区间seek */
+	retval = miniwave_seek(wav, 0);
+	if (retval < 0)
+		goto ERR_EXIT;
+
+	free(buffer);
+
+	*regions = scan.regions;
+
+	return scan.count;
+
+ERR_EXIT:
+	free(buffer);
+	free(scan.regions);
+
+	return retval;
+}
+
+int miniwave_silence_scan(WAV wav, double threshold, unsigned int minimum, WAV_REGION *regions, int count)
+{
+	WAV_REGION *found = NULL;
+	int retval = 0;
+
+	if ((wav == NULL) || isnan(threshold) || (count < 0) || ((regions == NULL) && count))
+	{
+		WAV_ERR("Invalid wav[%p] threshold[%f] regions[%p] count[%d]", wav, threshold, regions, count);
+		return -EINVAL;
+	}
+
+	retval = wave_silence_scan(wav, threshold, minimum, &found);
+	if (retval < 0)
+		return retval;
+
+	if (regions)
+		memcpy(regions, found, ((retval < count) ? retval : count) * sizeof(WAV_REGION));
+
+	free(found);
+
+	return retval;
+}
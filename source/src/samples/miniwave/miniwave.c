@@ -28,12 +28,49 @@ static struct libops libops[] =
 
 #define USAGE_STRING \
 "\
-usage: " NAME_STRING "[options]\n\
+usage: " NAME_STRING "[options] <input> <output>\n\
+       " NAME_STRING " --trim=<start>,<frames> <input> <output>\n\
+       " NAME_STRING " --concat <output> <input> [input...]\n\
+       " NAME_STRING " --normalize=<peak|lufs>,<target> <file>\n\
+       " NAME_STRING " --silence=<dBFS>,<ms> <input> <output>\n\
+       " NAME_STRING " --hash <input> [input...]\n\
    MiniWave音频解码&保存\n\
         --help        display help and exit\n\
         --version     display version and exit\n\
+        --direct      write output through O_DIRECT\n\
+        --prealloc    preallocate output to the input data size\n\
+        --readahead   prefetch input in a background thread\n\
+        --trim        copy <frames> frames from frame <start> in kernel\n\
+        --concat      concatenate inputs with the same format in kernel\n\
+        --adpcm       encode 16bit output as IMA ADPCM\n\
+        --lossless    encode output with the lossless codec\n\
+        --normalize   normalize peak(dBFS) or loudness(LUFS) in place, peak <= -1dBFS\n\
+        --silence     drop silence below <dBFS> lasting at least <ms>\n\
+        --hash        print PCM payload hashes and check stored hash chunks\n\
+        --store-hash  store the PCM payload hash in the output\n\
 "
 
+enum
+{
+	MODE_COPY,
+	MODE_TRIM,
+	MODE_CONCAT,
+	MODE_NORMALIZE,
+	MODE_SILENCE,
+	MODE_HASH,
+};
+
+static int mode = MODE_COPY;
+static unsigned int trim_start = 0;
+static unsigned int trim_frames = 0;
+static int norm_mode = WAVE_NORM_PEAK;
+static double norm_target = 0;
+static double silence_threshold = 0;
+static unsigned int silence_minimum = 0;
+
+static int owave_flags = WAVE_O_WRONLY;
+static int readahead = 0;
+
 static void display_help(void)
 {
 	printf(USAGE_STRING);
@@ -76,6 +113,17 @@ static void process_options(int argc, char **argv)
 		{
 			{"help", 	no_argument, 0, 0},
 			{"version", no_argument, 0, 0},
+			{"direct", 	no_argument, 0, 0},
+			{"prealloc", no_argument, 0, 0},
+			{"readahead", no_argument, 0, 0},
+			{"trim", 	required_argument, 0, 0},
+			{"concat", 	no_argument, 0, 0},
+			{"adpcm", 	no_argument, 0, 0},
+			{"lossless", no_argument, 0, 0},
+			{"normalize", required_argument, 0, 0},
+			{"silence", required_argument, 0, 0},
+			{"hash", 	no_argument, 0, 0},
+			{"store-hash", no_argument, 0, 0},
 			{0, 0, 0, 0},
 		};
 
@@ -94,6 +142,49 @@ static void process_options(int argc, char **argv)
 			case 1:
 				display_version();
 				break;
+			case 2:
+				owave_flags |= WAVE_O_DIRECT;
+				break;
+			case 3:
+				owave_flags |= WAVE_O_PREALLOC;
+				break;
+			case 4:
+				readahead = 1;
+				break;
+			case 5:
+				if (sscanf(optarg, "%u,%u", &trim_start, &trim_frames) != 2)
+					display_help();
+				mode = MODE_TRIM;
+				break;
+			case 6:
+				mode = MODE_CONCAT;
+				break;
+			case 7:
+				owave_flags |= WAVE_O_ADPCM;
+				break;
+			case 8:
+				owave_flags |= WAVE_O_LOSSLESS;
+				break;
+			case 9:
+				if (sscanf(optarg, "peak,%lf", &norm_target) == 1)
+					norm_mode = WAVE_NORM_PEAK;
+				else if (sscanf(optarg, "lufs,%lf", &norm_target) == 1)
+					norm_mode = WAVE_NORM_LOUDNESS;
+				else
+					display_help();
+				mode = MODE_NORMALIZE;
+				break;
+			case 10:
+				if (sscanf(optarg, "%lf,%u", &silence_threshold, &silence_minimum) != 2)
+					display_help();
+				mode = MODE_SILENCE;
+				break;
+			case 11:
+				mode = MODE_HASH;
+				break;
+			case 12:
+				owave_flags |= WAVE_O_HASH;
+				break;
 			}
 			break;
 		case '?':
@@ -116,14 +207,79 @@ int main(int argc, char **argv)
 
 	process_options(argc, argv);
 
-	iwave = miniwave_open(argv[1], WAVE_O_RDONLY, &attr);
+	if (argc - optind < (((mode == MODE_NORMALIZE) || (mode == MODE_HASH)) ? 1 : 2))
+		display_help();
+
+	if (mode == MODE_TRIM)
+	{
+		retval = miniwave_trim(argv[optind], argv[optind + 1], trim_start, trim_frames);
+		return (retval < 0) ? retval : 0;
+	}
+
+	if (mode == MODE_CONCAT)
+	{
+		retval = miniwave_concat(argv[optind], (const char **)&argv[optind + 1], argc - optind - 1);
+		return (retval < 0) ? retval : 0;
+	}
+
+	if (mode == MODE_HASH)
+	{
+		WAV_HASH hash;
+		WAV_HASH stored;
+		int i = 0;
+
+		for (i = optind; i < argc; i++)
+		{
+			retval = miniwave_hash_file(argv[i], &hash);
+			if (retval < 0)
+				return retval;
+
+			if (miniwave_hash_stored(argv[i], &stored) < 0)
+				printf("%016llx  %s\n", hash.root, argv[i]);
+			else
+				printf("%016llx  %s  %s\n", hash.root, argv[i],
+					((stored.root == hash.root) && (stored.bytes == hash.bytes)) ? "ok" : "MISMATCH");
+		}
+
+		return 0;
+	}
+
+	if (mode == MODE_SILENCE)
+	{
+		retval = miniwave_silence_trim(argv[optind], argv[optind + 1], silence_threshold, silence_minimum);
+		if (retval >= 0)
+			printf("%d frames kept\n", retval);
+		return (retval < 0) ? retval : 0;
+	}
+
+	if (mode == MODE_NORMALIZE)
+	{
+		WAV_LEVEL level;
+
+		retval = miniwave_normalize(argv[optind], norm_mode, norm_target, -1.0, &level);
+		if (retval >= 0)
+			printf("peak %.2fdBFS loudness %.2fLUFS gain %.2fdB\n",
+				level.peak, level.loudness, level.gain);
+		return (retval < 0) ? retval : 0;
+	}
+
+	iwave = miniwave_open(argv[optind], WAVE_O_RDONLY, &attr);
 	if (iwave == NULL)
 	{
 		retval = -EPERM;
 		goto ERR_EXIT;
 	}
 
-	owave = miniwave_open(argv[2], WAVE_O_WRONLY, &attr);
+	if (readahead)
+	{
+		retval = miniwave_readahead(iwave, 0, 0);
+		if (retval < 0)
+			goto ERR_EXIT;
+	}
+
+	attr.prealloc = attr.datasize;
+
+	owave = miniwave_open(argv[optind + 1], owave_flags, &attr);
 	if (owave == NULL)
 	{
 		retval = -EPERM;
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2022 - 2023, tangchunhui@coros.com
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+/************************************************************************************************************************/
+
+#include "miniwave.hpp"
+
+struct libops
+{
+	void (*version)(char *name, int *major, int *minor, char *date);
+};
+
+static struct libops libops[] =
+{
+	{miniwave_version},
+};
+
+/************************************************************************************************************************/
+
+#include <getopt.h>
+
+#define USAGE_STRING \
+"\
+usage: " NAME_STRING "[options] <input> <output>\n\
+    MiniWave C++接口示例: 按float读入, 转换位宽后写出\n\
+        --help        display help and exit\n\
+        --version     display version and exit\n\
+        --bits        output sample bits, 8/16/24/32, default 24\n\
+"
+
+static unsigned int bits = 24;
+
+static void display_help(void)
+{
+	printf(USAGE_STRING);
+	exit(0);
+}
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof(a[0]))
+#endif
+
+static void display_version(void)
+{
+	unsigned int i;
+
+	printf(NAME_STRING " version: %d.%d [%s]\n", VERSION_MAJOR, VERSION_MINOR, BUILD_DATE);
+
+	for (i = 0; i < ARRAY_SIZE(libops); i++)
+	{
+		if (libops[i].version)
+		{
+			char name[64]="";
+			int  major, minor;
+			char date[64]="";
+
+			libops[i].version(name, &major, &minor, date);
+			printf("	%s version: %d.%d [%s]\n", name, major, minor, date);
+		}
+	}
+
+	exit(0);
+}
+
+static void process_options(int argc, char **argv)
+{
+	for (;;)
+	{
+		int option_index = 0;
+		static const char * short_options = "";
+		static const struct option long_options[] =
+		{
+			{"help", 	no_argument, 0, 0},
+			{"version", no_argument, 0, 0},
+			{"bits", 	required_argument, 0, 0},
+			{0, 0, 0, 0},
+		};
+
+		int opt = getopt_long(argc, argv, short_options,
+							long_options, &option_index);
+		if (opt == EOF) break;
+
+		switch(opt)
+		{
+		case 0:
+			switch(option_index)
+			{
+			case 0:
+				display_help();
+				break;
+			case 1:
+				display_version();
+				break;
+			case 2:
+				bits = strtoul(optarg, NULL, 0);
+				break;
+			}
+			break;
+		case '?':
+			printf("Unknown option %c\n", optopt);
+			break;
+		}
+	}
+}
+
+/************************************************************************************************************************/
+
+int main(int argc, char **argv)
+{
+	std::size_t frames = 0;
+	int retval = 0;
+
+	process_options(argc, argv);
+
+	if (argc - optind != 2)
+		display_help();
+
+	/* 通道数运行时确定, 样本统一按float处理 */
+	miniwave::reader<float> input(argv[optind]);
+	if (!input)
+	{
+		printf("open %s fail[%d]\n", argv[optind], input.error());
+		return -1;
+	}
+
+	miniwave::writer<float> output(argv[optind + 1], input.samprate(), input.channels(), bits);
+	if (!output)
+	{
+		printf("open %s fail[%d]\n", argv[optind + 1], output.error());
+		return -1;
+	}
+
+	for (auto block = input.read(); !block.empty(); block = input.read())
+	{
+		retval = output.write(block);
+		if (retval < 0)
+		{
+			printf("write %s fail[%d]\n", argv[optind + 1], retval);
+			return -1;
+		}
+
+		frames += block.size() / input.channels();
+	}
+
+	if (input.error() < 0)
+	{
+		printf("read %s fail[%d]\n", argv[optind], input.error());
+		return -1;
+	}
+
+	retval = output.close();
+	if (retval < 0)
+	{
+		printf("close %s fail[%d]\n", argv[optind + 1], retval);
+		return -1;
+	}
+
+	printf("%s: %zu frames, %u bits -> %s: %u bits\n",
+		argv[optind], frames, input.sampbits(), argv[optind + 1], bits);
+
+	return 0;
+}